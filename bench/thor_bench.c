@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include "../src/utils/constants.h"
+
+/*
+    thor-bench: runs one workload against the engine linked in directly
+    and prints a single JSON line with its throughput, latency
+    percentiles and buffer pool counters.
+
+    thor-bench [--workload NAME] [--rows N] [--ops N] [--frames N]
+               [--io sync|uring] [--direct] [--mmap] [--scan-length N]
+               [--read-ratio R] [--seed N] [--db PATH]
+
+    Workloads: seq-insert and rand-insert insert --rows rows; lookup,
+    zipf-lookup, scan and mix first bulk load --rows rows and then run
+    --ops operations on them. zipf-lookup favours the smallest ids, mix
+    looks up --read-ratio of the time and inserts new rows otherwise.
+*/
+
+typedef enum
+{
+    WORKLOAD_SEQ_INSERT,
+    WORKLOAD_RAND_INSERT,
+    WORKLOAD_LOOKUP,
+    WORKLOAD_ZIPF_LOOKUP,
+    WORKLOAD_SCAN,
+    WORKLOAD_MIX
+} Workload;
+
+static const char* workload_names[] = {"seq-insert", "rand-insert", "lookup",
+                                       "zipf-lookup", "scan", "mix"};
+
+typedef struct
+{
+    Workload workload;
+    uint64_t rows;
+    uint64_t ops;
+    uint32_t frames;
+    PagerIo io;
+    bool direct_io;
+    bool mmap;
+    uint32_t scan_length;
+    double read_ratio;
+    uint64_t seed;
+    const char* path;
+} BenchConfig;
+
+// zipfian ranks in [0, n) with skew theta, as in Gray et al.
+typedef struct
+{
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zeta_n;
+    double eta;
+} Zipf;
+
+static uint64_t rng_state;
+
+// xorshift64*
+static uint64_t next_random(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static double next_unit(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void zipf_init(Zipf* zipf, uint64_t n, double theta)
+{
+    zipf->n = n;
+    zipf->theta = theta;
+    zipf->zeta_n = 0;
+    for (uint64_t i = 1; i <= n; i++)
+        zipf->zeta_n += 1.0 / pow((double)i, theta);
+    double zeta_2 = 1.0 + 1.0 / pow(2.0, theta);
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta_2 / zipf->zeta_n);
+}
+
+static uint64_t zipf_next(Zipf* zipf)
+{
+    double u = next_unit();
+    double uz = u * zipf->zeta_n;
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, zipf->theta))
+        return 1;
+    uint64_t rank = (uint64_t)(zipf->n * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+    return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+static void make_row(Row* row, uint64_t id)
+{
+    memset(row, 0, sizeof(Row));
+    row->id = id;
+    snprintf(row->username, COLUMN_USERNAME_SIZE, "user%" PRIu64, id);
+    snprintf(row->email, COLUMN_EMAIL_SIZE, "person%" PRIu64 "@example.com", id);
+}
+
+static void insert_row(Table* table, PreparedStatement* insert, uint64_t id)
+{
+    Row row;
+    make_row(&row, id);
+    prepared_bind_int(insert, 0, id);
+    prepared_bind_text(insert, 1, row.username);
+    prepared_bind_text(insert, 2, row.email);
+    if (prepared_execute(insert, table) != EXECUTE_SUCCESS) {
+        printf("Insert of id %" PRIu64 " failed\n", id);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void lookup_row(Table* table, uint64_t id)
+{
+    Row row;
+    if (!table_get(table, id, &row)) {
+        printf("Row %" PRIu64 " not found\n", id);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void scan_rows(Table* table, uint64_t start_id, uint32_t length)
+{
+    Cursor* cursor = scan_start(table, start_id);
+    for (uint32_t i = 0; i < length && !cursor->end_of_table; i++) {
+        // touch the payload so the scan is not just a walk over keys
+        volatile uint8_t first = *(uint8_t*)scan_value(cursor);
+        (void)first;
+        scan_advance(cursor);
+    }
+    scan_close(cursor);
+}
+
+// rows 1..count loaded bottom-up, the starting point of the read workloads
+static void preload(Table* table, uint64_t count)
+{
+    Row* rows = malloc(count * sizeof(Row));
+    for (uint64_t i = 0; i < count; i++)
+        make_row(&rows[i], i + 1);
+    if (table_bulk_load(table, rows, count, BULK_LOAD_DEFAULT_FILL_FACTOR) != EXECUTE_SUCCESS) {
+        printf("Preload failed\n");
+        exit(EXIT_FAILURE);
+    }
+    pager_commit(table->pager);
+    pager_checkpoint(table->pager);
+    free(rows);
+}
+
+static void usage(void)
+{
+    printf("Usage: thor-bench [--workload seq-insert|rand-insert|lookup|zipf-lookup|scan|mix]\n"
+           "                  [--rows N] [--ops N] [--frames N] [--io sync|uring] [--direct]\n"
+           "                  [--mmap] [--scan-length N] [--read-ratio R] [--seed N] [--db PATH]\n");
+    exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char** argv, BenchConfig* config)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--direct") == 0) {
+            config->direct_io = true;
+            continue;
+        }
+        if (strcmp(arg, "--mmap") == 0) {
+            config->mmap = true;
+            continue;
+        }
+        if (value == NULL)
+            usage();
+        i++;
+        if (strcmp(arg, "--workload") == 0) {
+            uint32_t w = 0;
+            while (w <= WORKLOAD_MIX && strcmp(value, workload_names[w]) != 0)
+                w++;
+            if (w > WORKLOAD_MIX)
+                usage();
+            config->workload = w;
+        } else if (strcmp(arg, "--rows") == 0) {
+            config->rows = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--ops") == 0) {
+            config->ops = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--frames") == 0) {
+            config->frames = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--io") == 0) {
+            if (strcmp(value, "sync") != 0 && strcmp(value, "uring") != 0)
+                usage();
+            config->io = strcmp(value, "uring") == 0 ? PAGER_IO_URING : PAGER_IO_SYNC;
+        } else if (strcmp(arg, "--scan-length") == 0) {
+            config->scan_length = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--read-ratio") == 0) {
+            config->read_ratio = strtod(value, NULL);
+        } else if (strcmp(arg, "--seed") == 0) {
+            config->seed = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--db") == 0) {
+            config->path = value;
+        } else {
+            usage();
+        }
+    }
+    if (config->rows == 0)
+        usage();
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig config = {.workload = WORKLOAD_SEQ_INSERT, .rows = 100000, .ops = 100000,
+                          .frames = PAGER_DEFAULT_FRAMES, .io = PAGER_IO_SYNC,
+                          .scan_length = 100, .read_ratio = 0.9, .seed = 42,
+                          .path = "thor-bench.db"};
+    parse_args(argc, argv, &config);
+    rng_state = config.seed == 0 ? 1 : config.seed;
+    char wal_path[4096];
+    snprintf(wal_path, sizeof(wal_path), "%s-wal", config.path);
+    unlink(config.path);
+    unlink(wal_path);
+    PagerConfig pager_config = {.mode = config.mmap ? PAGER_MODE_MMAP : PAGER_MODE_BUFFERED,
+                                .num_frames = config.frames, .use_wal = true,
+                                .group_commit_size = WAL_GROUP_COMMIT_SIZE, .io = config.io,
+                                .direct_io = config.direct_io};
+    Table* table = db_open_with_config(config.path, &pager_config);
+    PreparedStatement insert;
+    if (table_prepare(table, "insert ? ? ?", &insert) != PREPARE_SUCCESS) {
+        printf("Unable to prepare insert\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool inserting = config.workload == WORKLOAD_SEQ_INSERT || config.workload == WORKLOAD_RAND_INSERT;
+    uint64_t* ids = NULL;
+    if (inserting) {
+        config.ops = config.rows;
+        ids = malloc(config.rows * sizeof(uint64_t));
+        for (uint64_t i = 0; i < config.rows; i++)
+            ids[i] = i + 1;
+        // Fisher-Yates
+        for (uint64_t i = config.rows - 1; config.workload == WORKLOAD_RAND_INSERT && i > 0; i--) {
+            uint64_t j = next_random() % (i + 1);
+            uint64_t id = ids[i];
+            ids[i] = ids[j];
+            ids[j] = id;
+        }
+    } else {
+        preload(table, config.rows);
+    }
+    Zipf zipf = {0};
+    if (config.workload == WORKLOAD_ZIPF_LOOKUP)
+        zipf_init(&zipf, config.rows, 0.99);
+    PagerStats before = table->pager->stats;
+    uint64_t next_id = config.rows + 1;
+
+    Histogram* histogram = calloc(1, sizeof(Histogram));
+    uint64_t start = stats_now_nsec();
+    for (uint64_t op = 0; op < config.ops; op++) {
+        uint64_t op_start = stats_now_nsec();
+        switch (config.workload) {
+        case WORKLOAD_SEQ_INSERT:
+        case WORKLOAD_RAND_INSERT:
+            insert_row(table, &insert, ids[op]);
+            break;
+        case WORKLOAD_LOOKUP:
+            lookup_row(table, 1 + next_random() % config.rows);
+            break;
+        case WORKLOAD_ZIPF_LOOKUP:
+            lookup_row(table, 1 + zipf_next(&zipf));
+            break;
+        case WORKLOAD_SCAN:
+            scan_rows(table, 1 + next_random() % config.rows, config.scan_length);
+            break;
+        case WORKLOAD_MIX:
+            if (next_unit() < config.read_ratio)
+                lookup_row(table, 1 + next_random() % config.rows);
+            else
+                insert_row(table, &insert, next_id++);
+            break;
+        }
+        histogram_record(histogram, stats_now_nsec() - op_start);
+    }
+    double seconds = (stats_now_nsec() - start) / 1e9;
+    PagerStats after = table->pager->stats;
+
+    printf("{\"workload\":\"%s\",\"rows\":%" PRIu64 ",\"ops\":%" PRIu64 ",\"frames\":%u,"
+           "\"io\":\"%s\",\"direct\":%s,\"mmap\":%s,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+           "\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 ","
+           "\"hits\":%" PRIu64 ",\"misses\":%" PRIu64 ",\"evictions\":%" PRIu64 ",\"prefetches\":%" PRIu64 "}\n",
+           workload_names[config.workload], config.rows, config.ops, table->pager->num_frames,
+           table->pager->ring != NULL ? "uring" : "sync", table->pager->direct_io ? "true" : "false",
+           config.mmap ? "true" : "false", seconds, seconds > 0 ? config.ops / seconds : 0.0,
+           histogram_percentile(histogram, 50), histogram_percentile(histogram, 99),
+           histogram_percentile(histogram, 99.9), histogram->max,
+           after.hits - before.hits, after.misses - before.misses,
+           after.evictions - before.evictions, after.prefetches - before.prefetches);
+    free(histogram);
+    free(ids);
+    db_close(table);
+    unlink(config.path);
+    unlink(wal_path);
+    return 0;
+}
@@ -1,6 +1,6 @@
 describe 'database' do
     before do
-      `rm -rf test.db`
+      `rm -rf test.db test.db-wal`
     end
   
     def run_script(commands)
@@ -21,6 +21,12 @@ describe 'database' do
       end
       raw_output.split("\n")
     end
+
+    # a row padded to the maximum lengths takes 303 bytes of a leaf with
+    # its key and slot, so 13 of them fit in one leaf
+    def wide_insert(i)
+      "insert #{i} #{"user#{i}".ljust(32, "u")} #{"person#{i}@".ljust(255, "e")}"
+    end
   
     it 'inserts and retrieves a row' do
       result = run_script([
@@ -57,16 +63,20 @@ describe 'database' do
       ])
     end
   
-    it 'prints error message when table is full' do
-      script = (1..1401).map do |i|
-        "insert #{i} user#{i} person#{i}@example.com"
-      end
-      script << ".exit"
-      result = run_script(script)
-      expect(result.last(2)).to match_array([
-        "db > Executed.",
-        "db > Need to implement splitting internal node",
+    it 'keeps inserting once internal nodes have to split' do
+      # the REPL echoes every statement, so load the rows in batch mode,
+      # which prints nothing for statements that succeed
+      File.write("split.txt", (1..10000).map { |i| wide_insert(i) + "\n" }.join)
+      expect(`./db --batch test.db split.txt`).to eq("")
+      File.delete("split.txt")
+
+      result = run_script([
+        "select where id = 10000",
+        ".stats",
+        ".quit",
       ])
+      expect(result[0]).to eq("db > (10000, #{"user10000".ljust(32, "u")}, #{"person10000@".ljust(255, "e")})")
+      expect(result).to include("tree_height: 3")
     end
   
     it 'allows inserting strings that are the maximum length' do
@@ -156,14 +166,14 @@ describe 'database' do
   
     it 'allows printing out the structure of a 3-leaf-node btree' do
       script = (1..14).map do |i|
-        "insert #{i} user#{i} person#{i}@example.com"
+        wide_insert(i)
       end
       script << ".btree"
-      script << "insert 15 user15 person15@example.com"
-      script << ".exit"
+      script << wide_insert(15)
+      script << ".quit"
       result = run_script(script)
   
-      expect(result[14...(result.length)]).to match_array([
+      expect(result[28...(result.length)]).to match_array([
         "db > Tree:",
         "- internal (size 1)",
         "  - leaf (size 7)",
@@ -183,49 +193,23 @@ describe 'database' do
         "    - 12",
         "    - 13",
         "    - 14",
-        "db > Executed.",
+        "db > Execute success",
+        "Executed statement :> '#{wide_insert(15)}' ",
         "db > ",
       ])
     end
   
     it 'allows printing out the structure of a 4-leaf-node btree' do
-      script = [
-        "insert 18 user18 person18@example.com",
-        "insert 7 user7 person7@example.com",
-        "insert 10 user10 person10@example.com",
-        "insert 29 user29 person29@example.com",
-        "insert 23 user23 person23@example.com",
-        "insert 4 user4 person4@example.com",
-        "insert 14 user14 person14@example.com",
-        "insert 30 user30 person30@example.com",
-        "insert 15 user15 person15@example.com",
-        "insert 26 user26 person26@example.com",
-        "insert 22 user22 person22@example.com",
-        "insert 19 user19 person19@example.com",
-        "insert 2 user2 person2@example.com",
-        "insert 1 user1 person1@example.com",
-        "insert 21 user21 person21@example.com",
-        "insert 11 user11 person11@example.com",
-        "insert 6 user6 person6@example.com",
-        "insert 20 user20 person20@example.com",
-        "insert 5 user5 person5@example.com",
-        "insert 8 user8 person8@example.com",
-        "insert 9 user9 person9@example.com",
-        "insert 3 user3 person3@example.com",
-        "insert 12 user12 person12@example.com",
-        "insert 27 user27 person27@example.com",
-        "insert 17 user17 person17@example.com",
-        "insert 16 user16 person16@example.com",
-        "insert 13 user13 person13@example.com",
-        "insert 24 user24 person24@example.com",
-        "insert 25 user25 person25@example.com",
-        "insert 28 user28 person28@example.com",
+      script = [18, 7, 10, 29, 23, 4, 14, 30, 15, 26, 22, 19, 2, 1, 21, 11, 6, 20, 5, 8, 9, 3, 12, 27, 17, 16, 13, 24, 25, 28].map do |i|
+        wide_insert(i)
+      end
+      script += [
         ".btree",
-        ".exit",
+        ".quit",
       ]
       result = run_script(script)
   
-      expect(result[30...(result.length)]).to match_array([
+      expect(result[60...(result.length)]).to match_array([
         "db > Tree:",
         "- internal (size 3)",
         "  - leaf (size 7)",
@@ -272,18 +256,18 @@ describe 'database' do
     it 'prints constants' do
       script = [
         ".constants",
-        ".exit",
+        ".quit",
       ]
       result = run_script(script)
   
       expect(result).to match_array([
         "db > Constants:",
-        "ROW_SIZE: 293",
+        "ROW_SIZE: 295",
         "COMMON_NODE_HEADER_SIZE: 6",
-        "LEAF_NODE_HEADER_SIZE: 14",
-        "LEAF_NODE_CELL_SIZE: 297",
-        "LEAF_NODE_SPACE_FOR_CELLS: 4082",
-        "LEAF_NODE_MAX_CELLS: 13",
+        "LEAF_NODE_HEADER_SIZE: 18",
+        "LEAF_NODE_SPACE_FOR_CELLS: 4078",
+        "LEAF_NODE_MAX_CELL_SIZE: 1009",
+        "LEAF_NODE_MAX_LOCAL_PAYLOAD: 1003",
         "db > ",
       ])
     end
@@ -315,44 +299,228 @@ describe 'database' do
         "Executed.", "db > ",
       ])
     end
-    it 'prints constants' do
-        script = [
-          ".constants",
-          ".exit",
-        ]
-        result = run_script(script)
-    
-        expect(result).to match_array([
-          "db > Constants:",
-          "ROW_SIZE: 293",
-          "COMMON_NODE_HEADER_SIZE: 6",
-          "LEAF_NODE_HEADER_SIZE: 10",
-          "LEAF_NODE_CELL_SIZE: 297",
-          "LEAF_NODE_SPACE_FOR_CELLS: 4086",
-          "LEAF_NODE_MAX_CELLS: 13",
-          "db > ",
-        ])
+    it 'bulk loads rows from a file with .import' do
+      File.write("import.txt", [3, 1, 2].map { |i| "#{i} user#{i} person#{i}@example.com\n" }.join)
+      result = run_script([
+        ".import import.txt",
+        "select",
+        ".quit",
+      ])
+      `rm -f import.txt`
+      expect(result).to match_array([
+        "db > Imported 3 rows.",
+        "db > (1, user1, person1@example.com)",
+        "(2, user2, person2@example.com)",
+        "(3, user3, person3@example.com)",
+        "Execute success",
+        "Executed statement :> 'select' ",
+        "db > ",
+      ])
+    end
+    it 'packs leaves full with .vacuum' do
+      script = (1..14).map do |i|
+        wide_insert(i)
       end
-      it 'allows printing out the structure of a one-node btree' do
-          script = [3, 1, 2].map do |i|
-            "insert #{i} user#{i} person#{i}@example.com"
-          end
-          script << ".btree"
-          script << ".exit"
-          result = run_script(script)
-      
-          expect(result).to match_array([
-            "db > Executed.",
-            "db > Executed.",
-            "db > Executed.",
-            "db > Tree:",
-            "leaf (size 3)",
-            "  - 0 : 1",
-            "  - 1 : 2",
-            "  - 2 : 3",
-            "db > "
-          ])
+      script << ".vacuum"
+      script << ".btree"
+      script << ".quit"
+      result = run_script(script)
+
+      # each insert prints two lines
+      expect(result[28...(result.length)]).to match_array([
+        "db > db > Tree:",
+        "- internal (size 1)",
+        "  - leaf (size 13)",
+        *(1..13).map { |i| "    - #{i}" },
+        "  - key 13",
+        "  - leaf (size 1)",
+        "    - 14",
+        "db > ",
+      ])
+    end
+    it 'selects rows by id and by id range' do
+      script = (1..20).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << "select where id = 7"
+      script << "select where id between 14 and 16"
+      script << "select where id between 18 and 100 limit 2"
+      script << ".quit"
+      result = run_script(script)
+      # each insert prints two lines
+      expect(result[40...result.length]).to match_array([
+        "db > (7, user7, person7@example.com)",
+        "Execute success",
+        "Executed statement :> 'select where id = 7' ",
+        "db > (14, user14, person14@example.com)",
+        "(15, user15, person15@example.com)",
+        "(16, user16, person16@example.com)",
+        "Execute success",
+        "Executed statement :> 'select where id between 14 and 16' ",
+        "db > (18, user18, person18@example.com)",
+        "(19, user19, person19@example.com)",
+        "Execute success",
+        "Executed statement :> 'select where id between 18 and 100 limit 2' ",
+        "db > ",
+      ])
+    end
+    it 'selects only the listed columns' do
+      result = run_script([
+        "insert 1 user1 person1@example.com",
+        "insert 2 user2 person2@example.com",
+        "select email, id",
+        ".quit",
+      ])
+      expect(result).to match_array([
+        "db > Execute success",
+        "Executed statement :> 'insert 1 user1 person1@example.com' ",
+        "db > Execute success",
+        "Executed statement :> 'insert 2 user2 person2@example.com' ",
+        "db > (person1@example.com, 1)",
+        "(person2@example.com, 2)",
+        "Execute success",
+        "Executed statement :> 'select email, id' ",
+        "db > ",
+      ])
+    end
+    it 'updates and deletes rows by id' do
+      result = run_script([
+        "insert 1 user1 person1@example.com",
+        "insert 2 user2 person2@example.com",
+        "update set email = two@example.com where id = 2",
+        "delete where id = 1",
+        "delete where id = 1",
+        "select",
+        ".quit",
+      ])
+      expect(result).to match_array([
+        "db > Execute success",
+        "Executed statement :> 'insert 1 user1 person1@example.com' ",
+        "db > Execute success",
+        "Executed statement :> 'insert 2 user2 person2@example.com' ",
+        "db > Execute success",
+        "Executed statement :> 'update set email = two@example.com where id = 2' ",
+        "db > Execute success",
+        "Executed statement :> 'delete where id = 1' ",
+        "db > Error: Row not found.",
+        "Executed statement :> 'delete where id = 1' ",
+        "db > (2, user2, two@example.com)",
+        "Execute success",
+        "Executed statement :> 'select' ",
+        "db > ",
+      ])
+    end
+    it 'merges underfull leaves after deletes' do
+      script = (1..14).map do |i|
+        wide_insert(i)
+      end
+      script += (1..3).map { |i| "delete where id = #{i}" }
+      script << ".btree"
+      script << ".quit"
+      result = run_script(script)
+
+      # each insert and delete prints two lines
+      expect(result[34...(result.length)]).to match_array([
+        "db > Tree:",
+        "- leaf (size 11)",
+        *(4..14).map { |i| "  - #{i}" },
+        "db > ",
+      ])
+    end
+    it 'inserts several rows at once and inside a transaction' do
+      result = run_script([
+        "insert values (3, user3, person3@example.com), (1, user1, person1@example.com)",
+        "insert values (4, user4, person4@example.com), (1, user1, person1@example.com)",
+        "begin",
+        "insert 2 user2 person2@example.com",
+        ".checkpoint",
+        "commit",
+        "commit",
+        "select",
+        ".quit",
+      ])
+      expect(result).to match_array([
+        "db > Execute success",
+        "Executed statement :> 'insert values (3, user3, person3@example.com), (1, user1, person1@example.com)' ",
+        "db > Error: Duplicate key.",
+        "Executed statement :> 'insert values (4, user4, person4@example.com), (1, user1, person1@example.com)' ",
+        "db > Execute success",
+        "Executed statement :> 'begin' ",
+        "db > Execute success",
+        "Executed statement :> 'insert 2 user2 person2@example.com' ",
+        "db > Cannot checkpoint inside a transaction.",
+        "db > Execute success",
+        "Executed statement :> 'commit' ",
+        "db > Error: No transaction to commit.",
+        "Executed statement :> 'commit' ",
+        "db > (1, user1, person1@example.com)",
+        "(2, user2, person2@example.com)",
+        "(3, user3, person3@example.com)",
+        "Execute success",
+        "Executed statement :> 'select' ",
+        "db > ",
+      ])
+    end
+    it 'prints engine counters with .stats' do
+      result = run_script([
+        "insert 1 user1 person1@example.com",
+        "insert 2 user2 person2@example.com",
+        "select where id between 1 and 2",
+        ".stats",
+        ".quit",
+      ])
+      # both inserts are synced before they report success
+      expect(result).to include("db > Stats:", "tree_height: 1", "leaf_splits: 0", "wal_syncs: 2")
+      expect(result).to include(a_string_matching(/^insert: count 2 rows 2 p50 \d+/))
+      expect(result).to include(a_string_matching(/^select: count 1 rows 2 p50 \d+/))
+    end
+    it 'logs slow statements with .slowlog' do
+      `rm -f slow.log`
+      result = run_script([
+        ".slowlog 0 slow.log",
+        "insert 1 user1 person1@example.com",
+        ".slowlog off",
+        "insert 2 user2 person2@example.com",
+        ".quit",
+      ])
+      log = File.readlines("slow.log", chomp: true)
+      `rm -f slow.log`
+      expect(result).to match_array([
+        "db > db > Execute success",
+        "Executed statement :> 'insert 1 user1 person1@example.com' ",
+        "db > db > Execute success",
+        "Executed statement :> 'insert 2 user2 person2@example.com' ",
+        "db > ",
+      ])
+      expect(log.length).to eq(1)
+      expect(log[0]).to match(/^slow insert: \d+ us prepare \d+ io \d+ split \d+ commit \d+ output \d+ other \d+ pages \d+ read \d+: insert 1 user1 person1@example.com$/)
+    end
+    it 'serves pipelined lookups and inserts with --listen' do
+      server = IO.popen(["./db", "--listen", "test.sock", "test.db"])
+      begin
+        expect(server.gets).to eq("Listening on test.sock\n")
+        output = IO.popen(["./thor-client", "test.sock"], "r+") do |client|
+          client.puts [
+            "insert 1 user1 person1@example.com",
+            "get 1",
+            "get 2",
+            "insert 1 user1 person1@example.com",
+          ]
+          client.close_write
+          client.read
         end
+      ensure
+        # a failed expectation must not leave the server running
+        Process.kill("TERM", server.pid)
+        server.close
+      end
+      expect(output.split("\n")).to eq([
+        "Executed.",
+        "(1, user1, person1@example.com)",
+        "Error: Row not found.",
+        "Error: Duplicate key.",
+      ])
+    end
         it 'prints an error message if there is a duplicate id' do
           script = [
             "insert 1 user1 person1@example.com",
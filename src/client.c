@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "input_buffer.h"
+#include "protocol.h"
+
+// requests sent ahead of their replies
+#ifndef CLIENT_WINDOW
+#define CLIENT_WINDOW 128
+#endif
+
+/*
+    thor-client <host:port | socket path>: reads "insert <id> <username>
+    <email>" and "get <id>" lines from stdin, pipelines them to a
+    db --listen server and prints one line per request, in input order.
+*/
+
+typedef struct
+{
+    // the encoded frame, NULL when the line did not parse
+    uint8_t* frame;
+    uint32_t frame_length;
+    // what to print for it, NULL until the reply is in
+    char* reply;
+} Request;
+
+static int client_connect(const char* address)
+{
+    const char* colon = strrchr(address, ':');
+    int fd;
+    if (colon != NULL && strchr(address, '/') == NULL) {
+        char host[256];
+        size_t host_length = colon - address;
+        if (host_length == 0 || host_length >= sizeof(host))
+            return -1;
+        memcpy(host, address, host_length);
+        host[host_length] = '\0';
+        struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+        struct addrinfo* info;
+        if (getaddrinfo(host, colon + 1, &hints, &info) != 0)
+            return -1;
+        fd = socket(info->ai_family, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, info->ai_addr, info->ai_addrlen) == -1) {
+            freeaddrinfo(info);
+            return -1;
+        }
+        freeaddrinfo(info);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+        struct sockaddr_un remote = {.sun_family = AF_UNIX};
+        if (strlen(address) >= sizeof(remote.sun_path))
+            return -1;
+        strcpy(remote.sun_path, address);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, (struct sockaddr*)&remote, sizeof(remote)) == -1)
+            return -1;
+    }
+    return fd;
+}
+
+static void send_all(int fd, const uint8_t* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0) {
+            printf("Error sending request: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+static void receive_all(int fd, uint8_t* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t bytes_read = recv(fd, data, length, 0);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read <= 0) {
+            printf("Connection closed by server\n");
+            exit(EXIT_FAILURE);
+        }
+        data += bytes_read;
+        length -= bytes_read;
+    }
+}
+
+// encode one input line as a request with id request_id, false if it does not parse
+static bool encode_request(const char* line, uint32_t request_id, Request* request)
+{
+    uint8_t frame[PROTOCOL_MAX_FRAME];
+    uint8_t* body = frame + PROTOCOL_HEADER_SIZE;
+    char username[256], email[PROTOCOL_MAX_FRAME];
+    uint64_t id;
+    uint32_t body_length;
+    uint8_t opcode;
+    int consumed = 0;
+    if (sscanf(line, "get %" SCNu64 " %n", &id, &consumed) == 1 && line[consumed] == '\0') {
+        opcode = PROTOCOL_GET;
+        protocol_put_u64(body, id);
+        body_length = sizeof(uint64_t);
+    } else if (sscanf(line, "insert %" SCNu64 " %255s %700s %n", &id, username, email, &consumed) == 3 &&
+               line[consumed] == '\0') {
+        opcode = PROTOCOL_INSERT;
+        body_length = protocol_put_row(body, id, username, strlen(username), email, strlen(email));
+    } else {
+        return false;
+    }
+    protocol_put_header(frame, body_length, request_id, opcode);
+    request->frame_length = PROTOCOL_HEADER_SIZE + body_length;
+    request->frame = malloc(request->frame_length);
+    memcpy(request->frame, frame, request->frame_length);
+    return true;
+}
+
+static char* format_reply(uint8_t status, const uint8_t* body, uint32_t length)
+{
+    char* reply = malloc(PROTOCOL_MAX_FRAME + 32);
+    uint64_t id;
+    const char* username;
+    const char* email;
+    uint32_t username_length, email_length;
+    switch (status) {
+    case PROTOCOL_OK:
+        if (length == 0)
+            strcpy(reply, "Executed.");
+        else if (protocol_get_row(body, length, &id, &username, &username_length, &email, &email_length))
+            sprintf(reply, "(%" PRIu64 ", %.*s, %.*s)", id, (int)username_length, username,
+                    (int)email_length, email);
+        else
+            strcpy(reply, "Error: Malformed reply.");
+        break;
+    case PROTOCOL_NOT_FOUND:
+        strcpy(reply, "Error: Row not found.");
+        break;
+    case PROTOCOL_DUPLICATE_KEY:
+        strcpy(reply, "Error: Duplicate key.");
+        break;
+    case PROTOCOL_BAD_REQUEST:
+        strcpy(reply, "Error: Bad request.");
+        break;
+    default:
+        strcpy(reply, "Error: Server error.");
+        break;
+    }
+    return reply;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        printf("Usage: thor-client <host:port | socket path>\n");
+        exit(EXIT_FAILURE);
+    }
+    int fd = client_connect(argv[1]);
+    if (fd == -1) {
+        printf("Unable to connect to %s: %d\n", argv[1], errno);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t count = 0, capacity = 64;
+    Request* requests = malloc(capacity * sizeof(Request));
+    InputBuffer* input_buffer = new_input_buffer();
+    while (read_input(input_buffer)) {
+        if (input_buffer->input_length == 0)
+            continue;
+        if (count == capacity) {
+            capacity *= 2;
+            requests = realloc(requests, capacity * sizeof(Request));
+        }
+        Request* request = &requests[count];
+        request->frame = NULL;
+        request->reply = NULL;
+        if (!encode_request(input_buffer->buffer, count, request))
+            request->reply = strdup("Syntax error. Could not parse statement");
+        count++;
+    }
+    close_input_buffer(input_buffer);
+
+    // keep up to CLIENT_WINDOW requests in flight, print replies in input order
+    uint32_t next_send = 0, next_print = 0, in_flight = 0;
+    uint8_t frame[PROTOCOL_MAX_FRAME];
+    while (next_print < count) {
+        while (next_send < count && in_flight < CLIENT_WINDOW) {
+            Request* request = &requests[next_send++];
+            if (request->frame == NULL)
+                continue;
+            send_all(fd, request->frame, request->frame_length);
+            in_flight++;
+        }
+        while (next_print < count && requests[next_print].reply != NULL) {
+            printf("%s\n", requests[next_print].reply);
+            free(requests[next_print].reply);
+            free(requests[next_print].frame);
+            next_print++;
+        }
+        if (in_flight == 0)
+            continue;
+        receive_all(fd, frame, PROTOCOL_LENGTH_SIZE);
+        uint32_t frame_length = protocol_get_u32(frame);
+        if (frame_length < PROTOCOL_HEADER_SIZE - PROTOCOL_LENGTH_SIZE ||
+            frame_length > PROTOCOL_MAX_FRAME - PROTOCOL_LENGTH_SIZE) {
+            printf("Malformed reply from server\n");
+            exit(EXIT_FAILURE);
+        }
+        receive_all(fd, frame + PROTOCOL_LENGTH_SIZE, frame_length);
+        uint32_t request_id = protocol_get_u32(frame + 4);
+        if (request_id >= count || requests[request_id].frame == NULL ||
+            requests[request_id].reply != NULL) {
+            printf("Reply to an unknown request from server\n");
+            exit(EXIT_FAILURE);
+        }
+        requests[request_id].reply = format_reply(frame[8], frame + PROTOCOL_HEADER_SIZE,
+                                                  PROTOCOL_LENGTH_SIZE + frame_length - PROTOCOL_HEADER_SIZE);
+        in_flight--;
+    }
+    free(requests);
+    close(fd);
+    return 0;
+}
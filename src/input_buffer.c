@@ -1,37 +1,111 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "input_buffer.h"
-#include "utils/stream.h"
 
-InputBuffer *new_input_buffer()
+static InputBuffer *new_input_buffer_fd(int fd)
 {
     InputBuffer *input_buffer = (InputBuffer *)malloc(sizeof(InputBuffer));
     input_buffer->buffer = NULL;
     input_buffer->buffer_length = 0;
     input_buffer->input_length = 0;
+    input_buffer->fd = fd;
+    input_buffer->data = malloc(INPUT_READ_SIZE);
+    input_buffer->data_capacity = INPUT_READ_SIZE;
+    input_buffer->start = 0;
+    input_buffer->end = 0;
     return input_buffer;
 }
 
+InputBuffer *new_input_buffer()
+{
+    return new_input_buffer_fd(STDIN_FILENO);
+}
+
+InputBuffer *new_input_buffer_from_file(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        printf("Unable to open file with name %s \n", filename);
+        exit(EXIT_FAILURE);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return new_input_buffer_fd(fd);
+}
+
 void print_prompt()
 {
     printf("db > ");
+    // the prompt has no newline, show it before blocking on input
+    fflush(stdout);
 }
 
-void read_input(InputBuffer *input_buffer)
+/*
+    Move the next line into buffer without its newline. Returns false
+    once the input is exhausted; a last line without a newline still
+    counts as a line.
+*/
+bool read_input(InputBuffer *input_buffer)
 {
-    size_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
-    if (bytes_read <= 0)
+    size_t scanned = input_buffer->start;
+    while (true)
     {
-        printf("Error reading input \n");
-        exit(EXIT_FAILURE);
+        char *data = input_buffer->data;
+        char *newline = memchr(data + scanned, '\n', input_buffer->end - scanned);
+        if (newline != NULL)
+        {
+            *newline = '\0';
+            break;
+        }
+        scanned = input_buffer->end;
+        // keep the partial line and make room behind it for the next block
+        if (input_buffer->start > 0)
+        {
+            memmove(data, data + input_buffer->start, input_buffer->end - input_buffer->start);
+            input_buffer->end -= input_buffer->start;
+            scanned = input_buffer->end;
+            input_buffer->start = 0;
+        }
+        if (input_buffer->data_capacity - input_buffer->end < INPUT_READ_SIZE)
+        {
+            input_buffer->data_capacity *= 2;
+            input_buffer->data = realloc(input_buffer->data, input_buffer->data_capacity);
+            data = input_buffer->data;
+        }
+        ssize_t bytes_read = read(input_buffer->fd, data + input_buffer->end,
+                                  input_buffer->data_capacity - input_buffer->end - 1);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read <= 0)
+        {
+            if (input_buffer->end == input_buffer->start)
+                return false;
+            data[input_buffer->end] = '\0';
+            scanned = input_buffer->end;
+            break;
+        }
+        input_buffer->end += bytes_read;
     }
-    input_buffer->input_length = bytes_read - 1;
-    input_buffer->buffer[bytes_read - 1] = 0;
+    char *data = input_buffer->data;
+    size_t length = strlen(data + input_buffer->start);
+    input_buffer->buffer = data + input_buffer->start;
+    input_buffer->input_length = length;
+    input_buffer->buffer_length = length + 1;
+    input_buffer->start = input_buffer->start + length + 1;
+    if (input_buffer->start > input_buffer->end)
+        input_buffer->start = input_buffer->end;
+    return true;
 }
 
 void close_input_buffer(InputBuffer *input_buffer)
 {
-    free(input_buffer->buffer);
+    if (input_buffer->fd != STDIN_FILENO)
+        close(input_buffer->fd);
+    free(input_buffer->data);
     free(input_buffer);
-}
\ No newline at end of file
+}
@@ -2,18 +2,37 @@
 #define INPUT_BUFFER_H_
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
 
+// bytes read(2) asks for at a time, lines longer than this grow the buffer
+#ifndef INPUT_READ_SIZE
+#define INPUT_READ_SIZE (1 << 16)
+#endif
+
+/*
+    Input is read in INPUT_READ_SIZE blocks and lines are cut out of
+    them in place: buffer points at the current line inside data and
+    stays valid until the next read_input.
+*/
 typedef struct
 {
     char *buffer;
     size_t buffer_length;
     ssize_t input_length;
+    int fd;
+    char *data;
+    size_t data_capacity;
+    // the bytes read but not yet returned are data[start, end)
+    size_t start;
+    size_t end;
 
 } InputBuffer;
 
 InputBuffer *new_input_buffer();
+InputBuffer *new_input_buffer_from_file(const char *);
 
 void print_prompt();
 void close_input_buffer(InputBuffer *);
-void read_input(InputBuffer *);
-#endif // INPUT_BUFFER_H_
\ No newline at end of file
+bool read_input(InputBuffer *);
+#endif // INPUT_BUFFER_H_
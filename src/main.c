@@ -4,21 +4,70 @@
 #include <string.h>
 #include "./utils/constants.h"
 #include "input_buffer.h"
+#include "server.h"
+
+// stdout buffer in batch mode, where nothing waits on a prompt
+#ifndef BATCH_OUTPUT_BUFFER_SIZE
+#define BATCH_OUTPUT_BUFFER_SIZE (1 << 16)
+#endif
 
 int main(int argc, char **argv)
 {
-    Table *table = new_table();
-    if (argc < 2) {
+    /*
+        db [--batch] <file> [script]: batch mode prints no prompts and
+        nothing for statements that succeed, and reads statements from
+        script, or from stdin without one.
+        db --listen <host:port | socket path> <file>: serve the database
+        to clients, see server.c.
+    */
+    if (argc > 1 && strcmp(argv[1], "--listen") == 0)
+    {
+        if (argc != 4)
+        {
+            printf("Usage: db --listen <host:port | socket path> <file>\n");
+            exit(EXIT_FAILURE);
+        }
+        PagerConfig config = {.mode = PAGER_MODE_BUFFERED, .num_frames = SERVER_FRAMES,
+                              .use_wal = true, .group_commit_size = WAL_GROUP_COMMIT_SIZE};
+        Table* table = db_open_with_config(argv[3], &config);
+        int status = server_run(table, argv[2]);
+        db_close(table);
+        return status;
+    }
+    bool batch = argc > 1 && strcmp(argv[1], "--batch") == 0;
+    int first_arg = batch ? 2 : 1;
+    if (argc <= first_arg || (!batch && argc > 2)) {
         printf("Must supply a database filename.\n");
         exit(EXIT_FAILURE);
     }
-    char* filename = argv[1];
+    char* filename = argv[first_arg];
     Table* table = db_open(filename);
-    InputBuffer *input_buffer = new_input_buffer();
+    InputBuffer *input_buffer = argc > first_arg + 1 ? new_input_buffer_from_file(argv[first_arg + 1])
+                                                     : new_input_buffer();
+    if (batch)
+    {
+        setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER_SIZE);
+        // nothing reports a statement done, so back-to-back commits share syncs
+        table->defer_sync = true;
+    }
     while (true)
     {
-        print_prompt();
-        read_input(input_buffer);
+        if (!batch)
+            print_prompt();
+        if (!read_input(input_buffer))
+        {
+            if (!batch)
+            {
+                printf("Error reading input \n");
+                exit(EXIT_FAILURE);
+            }
+            // the end of a script closes the database like .exit
+            close_input_buffer(input_buffer);
+            db_close(table);
+            exit(EXIT_SUCCESS);
+        }
+        if (batch && input_buffer->input_length == 0)
+            continue;
 
         // verify if the input is a command
         if (input_buffer->buffer[0] == '.')
@@ -41,6 +90,12 @@ int main(int argc, char **argv)
         case PREPARE_SYNTAX_ERROR:
             printf("Syntax error. Could not parse statement\n");
             continue;
+        case PREPARE_NEGATIVE_ID:
+            printf("ID must be positive.\n");
+            continue;
+        case PREPARE_STRING_TOO_LONG:
+            printf("String is too long.\n");
+            continue;
         case PREPARE_UNRECOGNIZED_STATEMENT:
             printf("Unrecongized keyword at  start of '%s'.\n", input_buffer->buffer);
             continue;
@@ -49,7 +104,8 @@ int main(int argc, char **argv)
         switch (execute_statement(&statement, table))
         {
         case EXECUTE_SUCCESS:
-            printf("Execute success\n");
+            if (!batch)
+                printf("Execute success\n");
             break;
         case EXECUTE_DUPLICATE_KEY:
             printf("Error: Duplicate key.\n");
@@ -57,8 +113,19 @@ int main(int argc, char **argv)
         case EXECUTE_TABLE_FULL:
             printf("Table is full\n");
             break;
+        case EXECUTE_ROW_NOT_FOUND:
+            printf("Error: Row not found.\n");
+            break;
+        case EXECUTE_ALREADY_IN_TRANSACTION:
+            printf("Error: Already in a transaction.\n");
+            break;
+        case EXECUTE_NOT_IN_TRANSACTION:
+            printf("Error: No transaction to commit.\n");
+            break;
         }
-        printf("Executed statement :> '%s' \n", input_buffer->buffer);
+        statement_release(&statement);
+        if (!batch)
+            printf("Executed statement :> '%s' \n", input_buffer->buffer);
     }
 
     return 0;
@@ -0,0 +1,129 @@
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+    The wire protocol of db --listen. Every message is a frame: the
+    length of the rest of the frame (4 bytes), a request id that the
+    response echoes (4 bytes) and an opcode, or a status in a response
+    (1 byte), then the body. Integers are little endian.
+
+    PROTOCOL_GET     body: id (8)
+                     reply: PROTOCOL_OK and a row, or PROTOCOL_NOT_FOUND
+    PROTOCOL_INSERT  body: a row
+                     reply: PROTOCOL_OK or PROTOCOL_DUPLICATE_KEY
+
+    A row is id (8), username length (1), username, email length (2),
+    email; the strings are not terminated. Any request can get
+    PROTOCOL_BAD_REQUEST back.
+
+    Requests may be pipelined. Lookups run on a worker pool, so their
+    replies come back as they finish and not in request order; match
+    them up by request id. An insert is done before any request sent
+    after it on the same connection starts.
+*/
+#define PROTOCOL_HEADER_SIZE 9
+#define PROTOCOL_LENGTH_SIZE 4
+// the largest frame either side accepts, length field included
+#define PROTOCOL_MAX_FRAME 1024
+
+typedef enum
+{
+    PROTOCOL_GET = 1,
+    PROTOCOL_INSERT = 2
+} ProtocolOpcode;
+
+typedef enum
+{
+    PROTOCOL_OK,
+    PROTOCOL_NOT_FOUND,
+    PROTOCOL_DUPLICATE_KEY,
+    PROTOCOL_BAD_REQUEST,
+    PROTOCOL_ERROR
+} ProtocolStatus;
+
+static inline void protocol_put_u16(uint8_t* out, uint16_t value)
+{
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static inline void protocol_put_u32(uint8_t* out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out[i] = value >> (8 * i);
+}
+
+static inline void protocol_put_u64(uint8_t* out, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        out[i] = value >> (8 * i);
+}
+
+static inline uint16_t protocol_get_u16(const uint8_t* in)
+{
+    return (uint16_t)(in[0] | in[1] << 8);
+}
+
+static inline uint32_t protocol_get_u32(const uint8_t* in)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--)
+        value = value << 8 | in[i];
+    return value;
+}
+
+static inline uint64_t protocol_get_u64(const uint8_t* in)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--)
+        value = value << 8 | in[i];
+    return value;
+}
+
+// the header of a frame with body_length bytes of body, at out
+static inline void protocol_put_header(uint8_t* out, uint32_t body_length, uint32_t request_id,
+                                       uint8_t code)
+{
+    protocol_put_u32(out, PROTOCOL_HEADER_SIZE - PROTOCOL_LENGTH_SIZE + body_length);
+    protocol_put_u32(out + 4, request_id);
+    out[8] = code;
+}
+
+// a row body at out, returns its length; username is at most 255 bytes
+static inline uint32_t protocol_put_row(uint8_t* out, uint64_t id, const char* username,
+                                        uint32_t username_length, const char* email,
+                                        uint32_t email_length)
+{
+    protocol_put_u64(out, id);
+    out[8] = username_length;
+    memcpy(out + 9, username, username_length);
+    protocol_put_u16(out + 9 + username_length, email_length);
+    memcpy(out + 11 + username_length, email, email_length);
+    return 11 + username_length + email_length;
+}
+
+/*
+    Split a row body of length bytes into views of its strings, false
+    when the lengths do not add up to exactly length.
+*/
+static inline bool protocol_get_row(const uint8_t* in, uint32_t length, uint64_t* id,
+                                    const char** username, uint32_t* username_length,
+                                    const char** email, uint32_t* email_length)
+{
+    if (length < 11)
+        return false;
+    *id = protocol_get_u64(in);
+    *username_length = in[8];
+    if (length < 11 + *username_length)
+        return false;
+    *username = (const char*)in + 9;
+    *email_length = protocol_get_u16(in + 9 + *username_length);
+    *email = (const char*)in + 11 + *username_length;
+    return length == 11 + *username_length + *email_length;
+}
+
+#endif // PROTOCOL_H_
@@ -0,0 +1,516 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "server.h"
+#include "protocol.h"
+
+/*
+    db --listen: one thread runs an epoll loop over every connection.
+    It reads frames, runs inserts itself (there is one writer anyway,
+    and it keeps a connection's requests after an insert behind it),
+    syncing the inserts of one read together, and hands lookups to
+    SERVER_WORKERS threads. A worker appends its reply
+    to the connection's output and wakes the loop through an eventfd
+    to send it. SIGINT or SIGTERM stop the loop and close the database.
+*/
+
+typedef struct
+{
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+typedef struct Connection
+{
+    int fd;
+    ByteBuffer in;
+    // output not sent yet, guarded by mutex
+    ByteBuffer out;
+    pthread_mutex_t mutex;
+    // lookups queued or running for this connection
+    uint32_t pending;
+    // closed by the loop, freed once no worker refers to it
+    bool closed;
+    // what the connection is polled for
+    uint32_t events;
+    // on the server's ready list, waiting for the loop to send its output
+    bool queued;
+    struct Connection* next_ready;
+} Connection;
+
+typedef struct
+{
+    Connection* connection;
+    uint32_t request_id;
+    uint64_t id;
+} Job;
+
+typedef struct
+{
+    Table* table;
+    int epoll_fd;
+    int listen_fd;
+    int wake_fd;
+    int signal_fd;
+    // guards the job queue, the ready list and stopping
+    pthread_mutex_t mutex;
+    pthread_cond_t job_added;
+    // a ring of jobs_capacity jobs
+    Job* jobs;
+    uint32_t jobs_head;
+    uint32_t jobs_count;
+    uint32_t jobs_capacity;
+    Connection* ready;
+    bool stopping;
+    pthread_t workers[SERVER_WORKERS];
+} Server;
+
+static void buffer_append(ByteBuffer* buffer, const void* data, size_t length)
+{
+    if (length == 0)
+        return;
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity == 0 ? PROTOCOL_MAX_FRAME : buffer->capacity;
+        while (capacity < buffer->length + length)
+            capacity *= 2;
+        buffer->data = realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+static void server_epoll(Server* server, int operation, int fd, uint32_t events, void* tag)
+{
+    struct epoll_event event = {.events = events, .data.ptr = tag};
+    if (epoll_ctl(server->epoll_fd, operation, fd, &event) == -1) {
+        printf("Error in epoll_ctl: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void connection_free(Connection* connection)
+{
+    pthread_mutex_destroy(&connection->mutex);
+    free(connection->in.data);
+    free(connection->out.data);
+    free(connection);
+}
+
+static void connection_close(Server* server, Connection* connection)
+{
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    pthread_mutex_lock(&connection->mutex);
+    connection->closed = true;
+    bool unused = connection->pending == 0 && !connection->queued;
+    pthread_mutex_unlock(&connection->mutex);
+    if (unused)
+        connection_free(connection);
+}
+
+/*
+    Send as much output as the socket takes, and poll for it to take
+    more while some is left. Past SERVER_MAX_OUTPUT unsent bytes the
+    connection is not read from until its output drains. False when
+    the peer is gone.
+*/
+static bool connection_flush(Server* server, Connection* connection)
+{
+    pthread_mutex_lock(&connection->mutex);
+    bool alive = true;
+    size_t sent = 0;
+    while (sent < connection->out.length) {
+        ssize_t written = send(connection->fd, connection->out.data + sent,
+                               connection->out.length - sent, MSG_NOSIGNAL);
+        if (written == -1) {
+            alive = errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            if (errno != EINTR)
+                break;
+            continue;
+        }
+        sent += written;
+    }
+    // keep only the unsent part, so the cap bounds the buffer too
+    memmove(connection->out.data, connection->out.data + sent, connection->out.length - sent);
+    connection->out.length -= sent;
+    uint32_t events = (connection->out.length < SERVER_MAX_OUTPUT ? EPOLLIN : 0) |
+                      (connection->out.length > 0 ? EPOLLOUT : 0);
+    if (alive && events != connection->events) {
+        connection->events = events;
+        server_epoll(server, EPOLL_CTL_MOD, connection->fd, events, connection);
+    }
+    pthread_mutex_unlock(&connection->mutex);
+    return alive;
+}
+
+// whether the connection has more output waiting than it may read input for
+static bool connection_output_full(Connection* connection)
+{
+    pthread_mutex_lock(&connection->mutex);
+    bool full = connection->out.length >= SERVER_MAX_OUTPUT;
+    pthread_mutex_unlock(&connection->mutex);
+    return full;
+}
+
+static void connection_reply(Connection* connection, uint32_t request_id, ProtocolStatus status,
+                             const uint8_t* body, uint32_t body_length)
+{
+    uint8_t header[PROTOCOL_HEADER_SIZE];
+    protocol_put_header(header, body_length, request_id, status);
+    pthread_mutex_lock(&connection->mutex);
+    buffer_append(&connection->out, header, sizeof(header));
+    buffer_append(&connection->out, body, body_length);
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+static void server_insert(Server* server, Connection* connection, uint32_t request_id,
+                          const uint8_t* body, uint32_t length)
+{
+    Statement statement;
+    memset(&statement, 0, sizeof(Statement));
+    statement.type = STATEMENT_INSERT;
+    Row* row = &statement.row_to_insert;
+    const char* username;
+    const char* email;
+    uint32_t username_length, email_length;
+    if (!protocol_get_row(body, length, &row->id, &username, &username_length, &email,
+                          &email_length) ||
+        username_length > COLUMN_USERNAME_SIZE || email_length > COLUMN_EMAIL_SIZE) {
+        connection_reply(connection, request_id, PROTOCOL_BAD_REQUEST, NULL, 0);
+        return;
+    }
+    memcpy(row->username, username, username_length);
+    memcpy(row->email, email, email_length);
+    ExecuteResult result = execute_statement(&statement, server->table);
+    ProtocolStatus status = result == EXECUTE_SUCCESS         ? PROTOCOL_OK
+                          : result == EXECUTE_DUPLICATE_KEY   ? PROTOCOL_DUPLICATE_KEY
+                                                              : PROTOCOL_ERROR;
+    connection_reply(connection, request_id, status, NULL, 0);
+}
+
+static void server_queue_lookup(Server* server, Connection* connection, uint32_t request_id,
+                                uint64_t id)
+{
+    pthread_mutex_lock(&connection->mutex);
+    connection->pending++;
+    pthread_mutex_unlock(&connection->mutex);
+    pthread_mutex_lock(&server->mutex);
+    if (server->jobs_count == server->jobs_capacity) {
+        // grow the ring, unwrapping it into the new array
+        Job* jobs = malloc(2 * server->jobs_capacity * sizeof(Job));
+        for (uint32_t i = 0; i < server->jobs_count; i++)
+            jobs[i] = server->jobs[(server->jobs_head + i) % server->jobs_capacity];
+        free(server->jobs);
+        server->jobs = jobs;
+        server->jobs_head = 0;
+        server->jobs_capacity *= 2;
+    }
+    uint32_t tail = (server->jobs_head + server->jobs_count) % server->jobs_capacity;
+    server->jobs[tail] = (Job){.connection = connection, .request_id = request_id, .id = id};
+    server->jobs_count++;
+    pthread_cond_signal(&server->job_added);
+    pthread_mutex_unlock(&server->mutex);
+}
+
+// the complete frames at the start of the input, false on a malformed one
+static bool connection_handle_input(Server* server, Connection* connection)
+{
+    size_t offset = 0;
+    ByteBuffer* in = &connection->in;
+    while (in->length - offset >= PROTOCOL_LENGTH_SIZE) {
+        uint32_t frame_length = protocol_get_u32(in->data + offset);
+        if (frame_length < PROTOCOL_HEADER_SIZE - PROTOCOL_LENGTH_SIZE ||
+            frame_length > PROTOCOL_MAX_FRAME - PROTOCOL_LENGTH_SIZE) {
+            return false;
+        }
+        if (in->length - offset < PROTOCOL_LENGTH_SIZE + frame_length)
+            break;
+        const uint8_t* frame = in->data + offset;
+        uint32_t request_id = protocol_get_u32(frame + 4);
+        const uint8_t* body = frame + PROTOCOL_HEADER_SIZE;
+        uint32_t body_length = PROTOCOL_LENGTH_SIZE + frame_length - PROTOCOL_HEADER_SIZE;
+        switch (frame[8]) {
+        case PROTOCOL_GET:
+            if (body_length == sizeof(uint64_t))
+                server_queue_lookup(server, connection, request_id, protocol_get_u64(body));
+            else
+                connection_reply(connection, request_id, PROTOCOL_BAD_REQUEST, NULL, 0);
+            break;
+        case PROTOCOL_INSERT:
+            server_insert(server, connection, request_id, body, body_length);
+            break;
+        default:
+            connection_reply(connection, request_id, PROTOCOL_BAD_REQUEST, NULL, 0);
+            break;
+        }
+        offset += PROTOCOL_LENGTH_SIZE + frame_length;
+    }
+    memmove(in->data, in->data + offset, in->length - offset);
+    in->length -= offset;
+    return true;
+}
+
+static void connection_read(Server* server, Connection* connection)
+{
+    uint8_t chunk[1 << 14];
+    // stop reading while the client is not reading its replies
+    while (!connection_output_full(connection)) {
+        ssize_t bytes_read = recv(connection->fd, chunk, sizeof(chunk), 0);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (bytes_read <= 0) {
+            connection_close(server, connection);
+            return;
+        }
+        buffer_append(&connection->in, chunk, bytes_read);
+        if (!connection_handle_input(server, connection)) {
+            connection_close(server, connection);
+            return;
+        }
+    }
+    // the inserts of this read share one sync, their replies wait for it
+    table_sync(server->table);
+    if (!connection_flush(server, connection))
+        connection_close(server, connection);
+}
+
+static void server_accept(Server* server)
+{
+    while (true) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+        int one = 1;
+        // fails harmlessly on a Unix domain socket
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Connection* connection = calloc(1, sizeof(Connection));
+        connection->fd = fd;
+        connection->events = EPOLLIN;
+        pthread_mutex_init(&connection->mutex, NULL);
+        server_epoll(server, EPOLL_CTL_ADD, fd, EPOLLIN, connection);
+    }
+}
+
+// send what workers replied, and free connections closed meanwhile
+static void server_drain_ready(Server* server)
+{
+    uint64_t wakeups;
+    if (read(server->wake_fd, &wakeups, sizeof(wakeups)) == -1 && errno != EAGAIN) {
+        printf("Error reading eventfd: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&server->mutex);
+    Connection* ready = server->ready;
+    server->ready = NULL;
+    pthread_mutex_unlock(&server->mutex);
+    while (ready != NULL) {
+        Connection* connection = ready;
+        ready = connection->next_ready;
+        pthread_mutex_lock(&connection->mutex);
+        connection->queued = false;
+        bool closed = connection->closed;
+        bool unused = closed && connection->pending == 0;
+        pthread_mutex_unlock(&connection->mutex);
+        // a failed send is left for the connection's own event to close
+        // it, that event may still come in this epoll_wait's batch
+        if (unused)
+            connection_free(connection);
+        else if (!closed)
+            connection_flush(server, connection);
+    }
+}
+
+static void* server_worker(void* argument)
+{
+    Server* server = argument;
+    uint8_t body[PROTOCOL_MAX_FRAME];
+    while (true) {
+        pthread_mutex_lock(&server->mutex);
+        while (server->jobs_count == 0 && !server->stopping)
+            pthread_cond_wait(&server->job_added, &server->mutex);
+        if (server->jobs_count == 0) {
+            pthread_mutex_unlock(&server->mutex);
+            statement_arena_release();
+            return NULL;
+        }
+        Job job = server->jobs[server->jobs_head];
+        server->jobs_head = (server->jobs_head + 1) % server->jobs_capacity;
+        server->jobs_count--;
+        pthread_mutex_unlock(&server->mutex);
+
+        Row row;
+        uint32_t body_length = 0;
+        ProtocolStatus status = PROTOCOL_NOT_FOUND;
+        if (table_get(server->table, job.id, &row)) {
+            status = PROTOCOL_OK;
+            body_length = protocol_put_row(body, row.id, row.username,
+                                           strnlen(row.username, COLUMN_USERNAME_SIZE), row.email,
+                                           strnlen(row.email, COLUMN_EMAIL_SIZE));
+        }
+        Connection* connection = job.connection;
+        connection_reply(connection, job.request_id, status, body, body_length);
+        pthread_mutex_lock(&connection->mutex);
+        connection->pending--;
+        bool queue = !connection->queued;
+        connection->queued = true;
+        pthread_mutex_unlock(&connection->mutex);
+        if (queue) {
+            pthread_mutex_lock(&server->mutex);
+            connection->next_ready = server->ready;
+            server->ready = connection;
+            pthread_mutex_unlock(&server->mutex);
+        }
+        uint64_t one = 1;
+        if (write(server->wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            printf("Error writing eventfd: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+    address is host:port for TCP, anything else is the path of a Unix
+    domain socket, replaced if it exists.
+*/
+static int server_listen(const char* address)
+{
+    const char* colon = strrchr(address, ':');
+    int fd;
+    if (colon != NULL && strchr(address, '/') == NULL) {
+        char host[256];
+        size_t host_length = colon - address;
+        if (host_length >= sizeof(host))
+            return -1;
+        memcpy(host, address, host_length);
+        host[host_length] = '\0';
+        struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+                                 .ai_flags = AI_PASSIVE};
+        struct addrinfo* info;
+        if (getaddrinfo(host_length > 0 ? host : NULL, colon + 1, &hints, &info) != 0)
+            return -1;
+        fd = socket(info->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+            bind(fd, info->ai_addr, info->ai_addrlen) == -1) {
+            freeaddrinfo(info);
+            return -1;
+        }
+        freeaddrinfo(info);
+    } else {
+        struct sockaddr_un local = {.sun_family = AF_UNIX};
+        if (strlen(address) >= sizeof(local.sun_path))
+            return -1;
+        strcpy(local.sun_path, address);
+        unlink(address);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1 || bind(fd, (struct sockaddr*)&local, sizeof(local)) == -1)
+            return -1;
+    }
+    if (listen(fd, SERVER_BACKLOG) == -1)
+        return -1;
+    return fd;
+}
+
+int server_run(Table* table, const char* address)
+{
+    Server* server = calloc(1, sizeof(Server));
+    server->table = table;
+    // connection_read syncs the inserts it ran before replying to them
+    table->defer_sync = true;
+    server->listen_fd = server_listen(address);
+    if (server->listen_fd == -1) {
+        printf("Unable to listen on %s: %d\n", address, errno);
+        exit(EXIT_FAILURE);
+    }
+    // the workers inherit the blocked signals, only the signalfd sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    server->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->signal_fd == -1 || server->wake_fd == -1 || server->epoll_fd == -1) {
+        printf("Unable to set up the event loop: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    // the fds' own fields tag their events, connections are tagged by themselves
+    server_epoll(server, EPOLL_CTL_ADD, server->listen_fd, EPOLLIN, &server->listen_fd);
+    server_epoll(server, EPOLL_CTL_ADD, server->wake_fd, EPOLLIN, &server->wake_fd);
+    server_epoll(server, EPOLL_CTL_ADD, server->signal_fd, EPOLLIN, &server->signal_fd);
+    pthread_mutex_init(&server->mutex, NULL);
+    pthread_cond_init(&server->job_added, NULL);
+    server->jobs_capacity = SERVER_MAX_EVENTS;
+    server->jobs = malloc(server->jobs_capacity * sizeof(Job));
+    for (uint32_t i = 0; i < SERVER_WORKERS; i++)
+        pthread_create(&server->workers[i], NULL, server_worker, server);
+    printf("Listening on %s\n", address);
+    fflush(stdout);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    bool stopping = false;
+    while (!stopping) {
+        int count = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count == -1) {
+            printf("Error in epoll_wait: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &server->listen_fd) {
+                server_accept(server);
+            } else if (tag == &server->wake_fd) {
+                server_drain_ready(server);
+            } else if (tag == &server->signal_fd) {
+                stopping = true;
+            } else {
+                Connection* connection = tag;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    connection_read(server, connection);
+                // connection_read may have closed and freed it
+                else if ((events[i].events & EPOLLOUT) && !connection_flush(server, connection))
+                    connection_close(server, connection);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&server->mutex);
+    server->stopping = true;
+    pthread_cond_broadcast(&server->job_added);
+    pthread_mutex_unlock(&server->mutex);
+    for (uint32_t i = 0; i < SERVER_WORKERS; i++)
+        pthread_join(server->workers[i], NULL);
+    close(server->listen_fd);
+    if (strchr(address, '/') != NULL || strrchr(address, ':') == NULL)
+        unlink(address);
+    close(server->wake_fd);
+    close(server->signal_fd);
+    close(server->epoll_fd);
+    pthread_cond_destroy(&server->job_added);
+    pthread_mutex_destroy(&server->mutex);
+    free(server->jobs);
+    free(server);
+    return EXIT_SUCCESS;
+}
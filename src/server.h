@@ -0,0 +1,28 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "./utils/constants.h"
+
+// threads that run lookups for --listen, inserts stay on the event loop
+#ifndef SERVER_WORKERS
+#define SERVER_WORKERS 4
+#endif
+// the buffer pool of --listen: room for the recent pins (PAGER_RECENT_PINS)
+// of every worker and the event loop on top of the usual pool
+#ifndef SERVER_FRAMES
+#define SERVER_FRAMES ((SERVER_WORKERS + 1) * PAGER_RECENT_PINS + PAGER_DEFAULT_FRAMES)
+#endif
+// unsent reply bytes past which a connection is not read from until they drain
+#ifndef SERVER_MAX_OUTPUT
+#define SERVER_MAX_OUTPUT (1 << 20)
+#endif
+#ifndef SERVER_MAX_EVENTS
+#define SERVER_MAX_EVENTS 64
+#endif
+#ifndef SERVER_BACKLOG
+#define SERVER_BACKLOG 128
+#endif
+
+int server_run(Table* table, const char* address);
+
+#endif // SERVER_H_
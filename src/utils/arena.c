@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+
+static ArenaBlock* arena_new_block(size_t size)
+{
+    size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + capacity);
+    if (block == NULL) {
+        printf("Unable to allocate arena block\n");
+        exit(EXIT_FAILURE);
+    }
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+/*
+    Bump size bytes off the current block. When it is full the next
+    kept block is reused if it is big enough, a new one is linked in
+    after the current block otherwise.
+*/
+void* arena_alloc(Arena* arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (arena->current == NULL) {
+        arena->first = arena->current = arena_new_block(size);
+    }
+    ArenaBlock* block = arena->current;
+    if (block->capacity - block->used < size) {
+        if (block->next == NULL || block->next->capacity < size) {
+            ArenaBlock* fresh = arena_new_block(size);
+            fresh->next = block->next;
+            block->next = fresh;
+        }
+        block = arena->current = block->next;
+        block->used = 0;
+    }
+    void* pointer = block->data + block->used;
+    block->used += size;
+    return pointer;
+}
+
+ArenaMark arena_mark(Arena* arena)
+{
+    ArenaMark mark = {arena->current, arena->current == NULL ? 0 : arena->current->used};
+    return mark;
+}
+
+// free everything allocated since mark, in O(1)
+void arena_rewind(Arena* arena, ArenaMark mark)
+{
+    if (mark.block == NULL) {
+        arena_reset(arena);
+        return;
+    }
+    arena->current = mark.block;
+    mark.block->used = mark.used;
+}
+
+void arena_reset(Arena* arena)
+{
+    arena->current = arena->first;
+    if (arena->current != NULL)
+        arena->current->used = 0;
+}
+
+void arena_release(Arena* arena)
+{
+    ArenaBlock* block = arena->first;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = arena->current = NULL;
+}
+
+/*
+    One page aligned block of num_pages pages, freed with free. Frames
+    carved from it start on page boundaries, as direct I/O needs.
+*/
+void* page_slab_alloc(size_t num_pages, size_t page_size)
+{
+    void* slab = NULL;
+    if (posix_memalign(&slab, page_size, num_pages * page_size) != 0)
+        return NULL;
+    return slab;
+}
@@ -0,0 +1,46 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef ARENA_BLOCK_SIZE
+#define ARENA_BLOCK_SIZE 4096
+#endif
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock* next;
+    size_t capacity;
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) uint8_t data[];
+} ArenaBlock;
+
+/*
+    A bump allocator for memory that lives as long as one statement.
+    Blocks are chained and kept across resets, so once the arena has
+    grown to what a statement needs, allocating is a pointer bump and
+    resetting is O(1).
+*/
+typedef struct
+{
+    ArenaBlock* first;
+    ArenaBlock* current;
+} Arena;
+
+// a position in an arena to rewind to, see arena_rewind
+typedef struct
+{
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+void* arena_alloc(Arena* arena, size_t size);
+ArenaMark arena_mark(Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+void arena_reset(Arena* arena);
+void arena_release(Arena* arena);
+void* page_slab_alloc(size_t num_pages, size_t page_size);
+
+#endif // ARENA_H_
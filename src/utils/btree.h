@@ -3,66 +3,609 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include "constants.h"
 
 typedef enum{
     NODE_INTERNAL,
-    NODE_LEAF
+    NODE_LEAF,
+    NODE_OVERFLOW,
+    NODE_FREE
 } NodeType;
 
-// common node header layout 
+#define INVALID_PAGE_NUM UINT32_MAX
+
+// common node header layout
 const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
 const uint32_t NODE_TYPE_OFFSET = 0;
 const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
 const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
 const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
 const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
-const uint8_t  COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + 
-                                         IS_ROOT_OFFSET + 
+const uint8_t  COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE +
+                                         IS_ROOT_SIZE +
                                          PARENT_POINTER_SIZE;
 
-// common leaf node header layout 
+// internal node header layout
+const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET +
+                                                  INTERNAL_NODE_NUM_KEYS_SIZE;
+const uint32_t INTERNAL_NODE_KEY_PREFIX_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEY_PREFIX_OFFSET = INTERNAL_NODE_RIGHT_CHILD_OFFSET +
+                                                 INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_KEY_WIDTH_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEY_WIDTH_OFFSET = INTERNAL_NODE_KEY_PREFIX_OFFSET +
+                                                INTERNAL_NODE_KEY_PREFIX_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                           INTERNAL_NODE_NUM_KEYS_SIZE +
+                                           INTERNAL_NODE_RIGHT_CHILD_SIZE +
+                                           INTERNAL_NODE_KEY_PREFIX_SIZE +
+                                           INTERNAL_NODE_KEY_WIDTH_SIZE;
+
+/*
+    internal node body layout: cell i is (child page, max key of child),
+    stored as an array of all the keys followed by an array of all the
+    children so a node is searched over contiguous keys.
+    Keys are prefix compressed: when every key of a node has the same
+    upper 32 bits, the node is narrow and keeps that prefix once in its
+    header and only the lower 32 bits of each key. Otherwise it is wide
+    and keeps whole keys, which costs about a third of the fanout.
+*/
+const uint32_t INTERNAL_NODE_NARROW_KEY_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_WIDE_KEY_SIZE = sizeof(uint64_t);
+const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEYS_OFFSET = INTERNAL_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_MAX_CELLS = INTERNAL_NODE_SPACE_FOR_CELLS /
+                                         (INTERNAL_NODE_NARROW_KEY_SIZE + INTERNAL_NODE_CHILD_SIZE);
+const uint32_t INTERNAL_NODE_WIDE_MAX_CELLS = INTERNAL_NODE_SPACE_FOR_CELLS /
+                                              (INTERNAL_NODE_WIDE_KEY_SIZE + INTERNAL_NODE_CHILD_SIZE);
+
+// common leaf node header layout
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + 
-                                       LEAF_NODE_NUM_CELLS_SIZE;
-
-// common leaf node body layout 
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET +
+                                            LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET +
+                                                LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                       LEAF_NODE_NUM_CELLS_SIZE +
+                                       LEAF_NODE_NEXT_LEAF_SIZE +
+                                       LEAF_NODE_CONTENT_START_SIZE;
+
+/*
+    Slotted leaf body: the keys, in order, are a contiguous array right
+    after the header so a lookup never touches the cells. It is followed
+    by an array of 16 bit cell offsets, one per key, while the cells
+    themselves are packed down from the end of the page. The content
+    start is the lowest cell. A cell is (payload size, payload), where
+    payload is a serialized row. A payload larger than
+    LEAF_NODE_MAX_LOCAL_PAYLOAD keeps its first bytes in the cell,
+    followed by the page number of an overflow chain.
+*/
+const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint64_t);
+const uint32_t LEAF_NODE_KEYS_OFFSET = LEAF_NODE_HEADER_SIZE;
+const uint32_t LEAF_NODE_SLOT_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_PAYLOAD_SIZE_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_PAYLOAD_SIZE_OFFSET = 0;
+const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_PAYLOAD_SIZE_OFFSET +
+                                        LEAF_NODE_PAYLOAD_SIZE_SIZE;
+const uint32_t LEAF_NODE_OVERFLOW_POINTER_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+// a leaf always has room for at least four cells
+const uint32_t LEAF_NODE_MAX_CELL_SIZE = LEAF_NODE_SPACE_FOR_CELLS / 4 -
+                                         LEAF_NODE_KEY_SIZE - LEAF_NODE_SLOT_SIZE;
+const uint32_t LEAF_NODE_MAX_LOCAL_PAYLOAD = LEAF_NODE_MAX_CELL_SIZE -
+                                             LEAF_NODE_VALUE_OFFSET -
+                                             LEAF_NODE_OVERFLOW_POINTER_SIZE;
+
+/*
+    Deletes leave a node underfull below these, it is then merged with
+    a sibling, or takes cells from it when the two do not fit one node.
+*/
+const uint32_t LEAF_NODE_MIN_USED = LEAF_NODE_SPACE_FOR_CELLS / 3;
+const uint32_t INTERNAL_NODE_MIN_KEYS = INTERNAL_NODE_WIDE_MAX_CELLS / 3;
+
+// overflow page layout: the rest of a payload, chained by next page
+const uint32_t OVERFLOW_NEXT_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t OVERFLOW_NEXT_PAGE_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t OVERFLOW_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + OVERFLOW_NEXT_PAGE_SIZE;
+const uint32_t OVERFLOW_SPACE_FOR_DATA = PAGE_SIZE - OVERFLOW_HEADER_SIZE;
+
+// free page layout: the next page of the freelist, 0 ends it
+const uint32_t FREE_PAGE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
+
+/*
+    Database header, always page 0: the page the tree's root is on and
+    the freelist, a chain of the pages dropped from the tree that new
+    pages are taken from before the file grows.
+*/
+#define DB_HEADER_PAGE_NUM 0
+const uint32_t DB_HEADER_MAGIC = 0x524F4854; // "THOR"
+const uint32_t DB_HEADER_MAGIC_OFFSET = 0;
+const uint32_t DB_HEADER_ROOT_PAGE_OFFSET = DB_HEADER_MAGIC_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_FREELIST_HEAD_OFFSET = DB_HEADER_ROOT_PAGE_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_FREE_PAGES_OFFSET = DB_HEADER_FREELIST_HEAD_OFFSET + sizeof(uint32_t);
+
+
+NodeType get_node_type(void* node){
+    uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
+    return (NodeType)value;
+}
 
+void set_node_type(void* node,NodeType type){
+    uint8_t value = type;
+    *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
+}
+
+bool is_node_root(void* node)
+{
+    uint8_t value = *((uint8_t*)(node + IS_ROOT_OFFSET));
+    return (bool)value;
+}
+
+void set_node_root(void* node, bool is_root)
+{
+    uint8_t value = is_root;
+    *((uint8_t*)(node + IS_ROOT_OFFSET)) = value;
+}
+
+uint32_t* node_parent(void* node)
+{
+    return node + PARENT_POINTER_OFFSET;
+}
+
+/*
+    Readers follow a leaf's parent pointer without the writer's latch on
+    the leaf (see scan_enter_leaf), so pointers the writer changes on
+    nodes it has not latched are stored atomically.
+*/
+uint32_t get_node_parent(void* node)
+{
+    return __atomic_load_n(node_parent(node), __ATOMIC_RELAXED);
+}
+
+void set_node_parent(void* node, uint32_t parent_page_num)
+{
+    __atomic_store_n(node_parent(node), parent_page_num, __ATOMIC_RELAXED);
+}
+
+uint32_t* internal_node_num_keys(void* node)
+{
+    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+uint32_t* internal_node_right_child(void* node)
+{
+    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+uint32_t* internal_node_key_prefix(void* node)
+{
+    return node + INTERNAL_NODE_KEY_PREFIX_OFFSET;
+}
+
+// INTERNAL_NODE_NARROW_KEY_SIZE or INTERNAL_NODE_WIDE_KEY_SIZE
+uint32_t* internal_node_key_width(void* node)
+{
+    return node + INTERNAL_NODE_KEY_WIDTH_OFFSET;
+}
+
+bool internal_node_is_wide(void* node)
+{
+    return *internal_node_key_width(node) == INTERNAL_NODE_WIDE_KEY_SIZE;
+}
+
+uint32_t internal_node_max_cells(void* node)
+{
+    return internal_node_is_wide(node) ? INTERNAL_NODE_WIDE_MAX_CELLS : INTERNAL_NODE_MAX_CELLS;
+}
+
+// uint32_t suffixes in a narrow node, uint64_t keys in a wide one
+void* internal_node_keys(void* node)
+{
+    return node + INTERNAL_NODE_KEYS_OFFSET;
+}
+
+// the child page of cell cell_num, the children follow the key array
+uint32_t* internal_node_cell(void* node, uint32_t cell_num)
+{
+    return node + INTERNAL_NODE_KEYS_OFFSET +
+           internal_node_max_cells(node) * *internal_node_key_width(node) +
+           cell_num * INTERNAL_NODE_CHILD_SIZE;
+}
+
+uint32_t* internal_node_child(void* node, uint32_t child_num)
+{
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (child_num > num_keys) {
+        printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t* child;
+    if (child_num == num_keys) {
+        child = internal_node_right_child(node);
+    } else {
+        child = internal_node_cell(node, child_num);
+    }
+    if (*child == INVALID_PAGE_NUM) {
+        printf("Tried to access child %d of node, but was invalid page\n", child_num);
+        exit(EXIT_FAILURE);
+    }
+    return child;
+}
+
+uint64_t internal_node_key(void* node, uint32_t key_num)
+{
+    if (internal_node_is_wide(node))
+        return ((uint64_t*)internal_node_keys(node))[key_num];
+    uint64_t prefix = *internal_node_key_prefix(node);
+    return prefix << 32 | ((uint32_t*)internal_node_keys(node))[key_num];
+}
+
+bool internal_node_key_fits(void* node, uint64_t key)
+{
+    return internal_node_is_wide(node) || key >> 32 == *internal_node_key_prefix(node);
+}
+
+// the key must fit the node's encoding, see internal_node_reserve_key
+void internal_node_set_key(void* node, uint32_t key_num, uint64_t key)
+{
+    if (internal_node_is_wide(node)) {
+        ((uint64_t*)internal_node_keys(node))[key_num] = key;
+    } else {
+        ((uint32_t*)internal_node_keys(node))[key_num] = (uint32_t)key;
+    }
+}
+
+// move the first num_keys keys and children up by one to open cell_num
+void internal_node_open_cell(void* node, uint32_t cell_num, uint32_t num_keys)
+{
+    uint32_t width = *internal_node_key_width(node);
+    void* keys = internal_node_keys(node);
+    memmove(internal_node_cell(node, cell_num + 1), internal_node_cell(node, cell_num),
+            (num_keys - cell_num) * INTERNAL_NODE_CHILD_SIZE);
+    memmove(keys + (cell_num + 1) * width, keys + cell_num * width, (num_keys - cell_num) * width);
+}
+
+// rewrite the keys and children of node with another key width and prefix
+void internal_node_encode(void* node, uint32_t key_width, uint32_t key_prefix)
+{
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint64_t keys[INTERNAL_NODE_MAX_CELLS];
+    uint32_t children[INTERNAL_NODE_MAX_CELLS];
+    for (uint32_t i = 0; i < num_keys; i++) {
+        keys[i] = internal_node_key(node, i);
+        children[i] = *internal_node_cell(node, i);
+    }
+    *internal_node_key_width(node) = key_width;
+    *internal_node_key_prefix(node) = key_prefix;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        *internal_node_cell(node, i) = children[i];
+        internal_node_set_key(node, i, keys[i]);
+    }
+}
+
+/*
+    Make room in the encoding for one more key. A node without keys
+    takes the key's prefix, a narrow node that cannot hold it is widened.
+    Returns false when the node has to be split first.
+*/
+bool internal_node_reserve_key(void* node, uint64_t key)
+{
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (num_keys == 0 && !internal_node_is_wide(node)) {
+        *internal_node_key_prefix(node) = key >> 32;
+        return true;
+    }
+    if (internal_node_key_fits(node, key))
+        return num_keys < internal_node_max_cells(node);
+    if (num_keys >= INTERNAL_NODE_WIDE_MAX_CELLS)
+        return false;
+    internal_node_encode(node, INTERNAL_NODE_WIDE_KEY_SIZE, 0);
+    return true;
+}
+
+/*
+    Whether a split of child child_index could not make node split too:
+    a split adds one key, between the keys around the child. Only a key
+    beside the first or right child can fall outside a narrow prefix.
+*/
+bool internal_node_can_take_key(void* node, uint32_t child_index)
+{
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (child_index > 0 && child_index < num_keys)
+        return num_keys < internal_node_max_cells(node);
+    return num_keys < INTERNAL_NODE_WIDE_MAX_CELLS;
+}
+
+// remove key cell_num and its child, the right child stays
+void internal_node_remove_cell(void* node, uint32_t cell_num)
+{
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t width = *internal_node_key_width(node);
+    void* keys = internal_node_keys(node);
+    memmove(internal_node_cell(node, cell_num), internal_node_cell(node, cell_num + 1),
+            (num_keys - cell_num - 1) * INTERNAL_NODE_CHILD_SIZE);
+    memmove(keys + cell_num * width, keys + (cell_num + 1) * width,
+            (num_keys - cell_num - 1) * width);
+    *internal_node_num_keys(node) = num_keys - 1;
+}
+
+// the index of child_page_num among the children of node
+uint32_t internal_node_child_index(void* node, uint32_t child_page_num)
+{
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i < num_keys; i++) {
+        if (*internal_node_cell(node, i) == child_page_num)
+            return i;
+    }
+    return num_keys;
+}
+
+/*
+    Whether key can replace one of the node's keys, widening the node
+    if needed. Only a node with more keys than a wide one holds cannot
+    take a key outside its prefix.
+*/
+bool internal_node_can_set_key(void* node, uint64_t key)
+{
+    return internal_node_key_fits(node, key) ||
+           *internal_node_num_keys(node) <= INTERNAL_NODE_WIDE_MAX_CELLS;
+}
+
+void internal_node_replace_key(void* node, uint32_t key_num, uint64_t key)
+{
+    if (!internal_node_key_fits(node, key))
+        internal_node_encode(node, INTERNAL_NODE_WIDE_KEY_SIZE, 0);
+    internal_node_set_key(node, key_num, key);
+}
+
+// the children of node and the keys between them, returns the number of children
+uint32_t internal_node_read(void* node, uint64_t* keys, uint32_t* children)
+{
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i < num_keys; i++) {
+        keys[i] = internal_node_key(node, i);
+        children[i] = *internal_node_cell(node, i);
+    }
+    children[num_keys] = *internal_node_right_child(node);
+    return num_keys + 1;
+}
+
+// whether num_keys sorted keys fit one node, narrow if they share a prefix
+bool internal_node_keys_fit(const uint64_t* keys, uint32_t num_keys)
+{
+    if (num_keys <= INTERNAL_NODE_WIDE_MAX_CELLS)
+        return true;
+    return num_keys <= INTERNAL_NODE_MAX_CELLS && keys[0] >> 32 == keys[num_keys - 1] >> 32;
+}
+
+// replace the cells of node, the keys must fit (internal_node_keys_fit)
+void internal_node_write(void* node, const uint64_t* keys, const uint32_t* children,
+                         uint32_t num_children)
+{
+    uint32_t num_keys = num_children - 1;
+    bool narrow = num_keys == 0 || keys[0] >> 32 == keys[num_keys - 1] >> 32;
+    *internal_node_num_keys(node) = num_keys;
+    *internal_node_key_width(node) = narrow ? INTERNAL_NODE_NARROW_KEY_SIZE : INTERNAL_NODE_WIDE_KEY_SIZE;
+    *internal_node_key_prefix(node) = narrow && num_keys > 0 ? keys[0] >> 32 : 0;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        *internal_node_cell(node, i) = children[i];
+        internal_node_set_key(node, i, keys[i]);
+    }
+    *internal_node_right_child(node) = children[num_keys];
+}
+
+// go back to narrow keys if a wide node lost the keys that needed it
+void internal_node_compact_keys(void* node)
+{
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (!internal_node_is_wide(node) || num_keys == 0)
+        return;
+    uint32_t prefix = internal_node_key(node, 0) >> 32;
+    for (uint32_t i = 1; i < num_keys; i++) {
+        if (internal_node_key(node, i) >> 32 != prefix)
+            return;
+    }
+    internal_node_encode(node, INTERNAL_NODE_NARROW_KEY_SIZE, prefix);
+}
 
 uint32_t* leaf_node_num_cells(void* node)
 {
-    return (node + LEAF_NODE_VALUE_OFFSET);
+    return (node + LEAF_NODE_NUM_CELLS_OFFSET);
+}
+
+uint32_t* leaf_node_next_leaf(void* node)
+{
+    // 0 means no sibling: page 0 is the database header and never a leaf
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+uint32_t* leaf_node_content_start(void* node)
+{
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+uint64_t* leaf_node_keys(void* node)
+{
+    return node + LEAF_NODE_KEYS_OFFSET;
+}
+
+uint64_t* leaf_node_key(void* node,uint32_t cell_num)
+{
+    return leaf_node_keys(node) + cell_num;
+}
+
+// the slot array starts after the last key, it moves as keys are added
+uint16_t* leaf_node_slot(void* node,uint32_t cell_num)
+{
+    return node + LEAF_NODE_KEYS_OFFSET + *leaf_node_num_cells(node) * LEAF_NODE_KEY_SIZE +
+           cell_num * LEAF_NODE_SLOT_SIZE;
 }
 
 void* leaf_node_cell(void* node,uint32_t cell_num)
 {
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE ;
+    return node + *leaf_node_slot(node, cell_num);
 }
 
-uint32_t* leaf_node_key(void* node,uint32_t cell_num)
+uint16_t* leaf_node_payload_size(void* node,uint32_t cell_num)
 {
-    return leaf_node_cell(node,cell_num);
+    return leaf_node_cell(node,cell_num) + LEAF_NODE_PAYLOAD_SIZE_OFFSET;
 }
 
+// the part of the payload stored in the cell
 void* leaf_node_value(void* node,uint32_t cell_num)
 {
-    return leaf_node_cell(node,cell_num)  + LEAF_NODE_KEY_SIZE;
+    return leaf_node_cell(node,cell_num) + LEAF_NODE_VALUE_OFFSET;
+}
+
+uint32_t leaf_cell_size(uint32_t payload_size)
+{
+    if (payload_size > LEAF_NODE_MAX_LOCAL_PAYLOAD) {
+        return LEAF_NODE_VALUE_OFFSET + LEAF_NODE_MAX_LOCAL_PAYLOAD +
+               LEAF_NODE_OVERFLOW_POINTER_SIZE;
+    }
+    return LEAF_NODE_VALUE_OFFSET + payload_size;
+}
+
+uint32_t leaf_node_cell_size(void* node,uint32_t cell_num)
+{
+    return leaf_cell_size(*leaf_node_payload_size(node, cell_num));
+}
+
+// first overflow page of a cell whose payload does not fit locally
+uint32_t* leaf_node_overflow_page(void* node,uint32_t cell_num)
+{
+    return leaf_node_value(node, cell_num) + LEAF_NODE_MAX_LOCAL_PAYLOAD;
+}
+
+uint32_t leaf_node_free_space(void* node)
+{
+    return *leaf_node_content_start(node) - LEAF_NODE_HEADER_SIZE -
+           *leaf_node_num_cells(node) * (LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE);
+}
+
+uint32_t leaf_node_used_space(void* node)
+{
+    return LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(node);
+}
+
+uint32_t* overflow_next_page(void* node)
+{
+    return node + OVERFLOW_NEXT_PAGE_OFFSET;
+}
+
+void* overflow_data(void* node)
+{
+    return node + OVERFLOW_HEADER_SIZE;
+}
+
+uint32_t* free_page_next(void* node)
+{
+    return node + FREE_PAGE_NEXT_OFFSET;
+}
+
+uint32_t* db_header_magic(void* page)
+{
+    return page + DB_HEADER_MAGIC_OFFSET;
+}
+
+uint32_t* db_header_root_page(void* page)
+{
+    return page + DB_HEADER_ROOT_PAGE_OFFSET;
+}
+
+uint32_t* db_header_freelist_head(void* page)
+{
+    return page + DB_HEADER_FREELIST_HEAD_OFFSET;
+}
+
+uint32_t* db_header_free_pages(void* page)
+{
+    return page + DB_HEADER_FREE_PAGES_OFFSET;
 }
 
 void initialize_leaf_node(void* node) {
     set_node_type(node, NODE_LEAF);
+    set_node_root(node, false);
     *leaf_node_num_cells(node) = 0;
+    *leaf_node_next_leaf(node) = 0;
+    *leaf_node_content_start(node) = PAGE_SIZE;
+}
+
+/*
+    Insert key and its cell at cell_num, the caller keeps key order and
+    checks that it fits. Only the key and slot arrays are shifted, the
+    cells stay where they are.
+*/
+void leaf_node_insert_cell(void* node, uint32_t cell_num, uint64_t key,
+                           const void* cell, uint32_t cell_size)
+{
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint64_t* keys = leaf_node_keys(node);
+    uint16_t* slots = (uint16_t*)(keys + num_cells);
+    uint16_t* new_slots = (uint16_t*)(keys + num_cells + 1);
+    // the slot array moves up by one key, the tail first so it is not overwritten
+    memmove(new_slots + cell_num + 1, slots + cell_num,
+            (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
+    memmove(new_slots, slots, cell_num * LEAF_NODE_SLOT_SIZE);
+    memmove(keys + cell_num + 1, keys + cell_num, (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+    keys[cell_num] = key;
+    *leaf_node_content_start(node) -= cell_size;
+    memcpy(node + *leaf_node_content_start(node), cell, cell_size);
+    new_slots[cell_num] = *leaf_node_content_start(node);
+    *leaf_node_num_cells(node) = num_cells + 1;
+}
+
+void leaf_node_append_cell(void* node, uint64_t key, const void* cell, uint32_t cell_size)
+{
+    leaf_node_insert_cell(node, *leaf_node_num_cells(node), key, cell, cell_size);
+}
+
+/*
+    Remove cell cell_num. The cells packed below it move up over the
+    gap, so the free space of a leaf always stays in one piece.
+*/
+void leaf_node_remove_cell(void* node, uint32_t cell_num)
+{
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint64_t* keys = leaf_node_keys(node);
+    uint16_t* slots = (uint16_t*)(keys + num_cells);
+    uint16_t offset = slots[cell_num];
+    uint32_t size = leaf_node_cell_size(node, cell_num);
+    uint32_t content_start = *leaf_node_content_start(node);
+    memmove(node + content_start + size, node + content_start, offset - content_start);
+    *leaf_node_content_start(node) = content_start + size;
+    memmove(keys + cell_num, keys + cell_num + 1, (num_cells - cell_num - 1) * LEAF_NODE_KEY_SIZE);
+    // the slot array moves down by one key, read ahead of every write
+    uint16_t* new_slots = (uint16_t*)(keys + num_cells - 1);
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        if (i == cell_num)
+            continue;
+        uint16_t slot = slots[i];
+        new_slots[j++] = slot < offset ? slot + size : slot;
+    }
+    *leaf_node_num_cells(node) = num_cells - 1;
+}
+
+void initialize_internal_node(void* node) {
+    set_node_type(node, NODE_INTERNAL);
+    set_node_root(node, false);
+    *internal_node_num_keys(node) = 0;
+    *internal_node_key_width(node) = INTERNAL_NODE_NARROW_KEY_SIZE;
+    *internal_node_key_prefix(node) = 0;
+    /*
+        An empty internal node has no right child yet. It is marked with
+        INVALID_PAGE_NUM, which the tree code checks for, not with 0
+        (the database header page, never a child).
+    */
+    *internal_node_right_child(node) = INVALID_PAGE_NUM;
 }
 
-#endif // BTREE_H
\ No newline at end of file
+#endif // BTREE_H
@@ -3,76 +3,276 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <errno.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include "constants.h"
 #include "btree.h"
+#include "wal.h"
+#include "mvcc.h"
+#include "search.h"
+#include "trace.h"
 
 
 void print_row(Row *row)
 {
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+    printf("(%" PRIu64 ", %s, %s)\n", row->id, row->username, row->email);
 }
 
 void print_constants() {
   printf("ROW_SIZE: %d\n", ROW_SIZE);
   printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
   printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
   printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-  printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+  printf("LEAF_NODE_MAX_CELL_SIZE: %d\n", LEAF_NODE_MAX_CELL_SIZE);
+  printf("LEAF_NODE_MAX_LOCAL_PAYLOAD: %d\n", LEAF_NODE_MAX_LOCAL_PAYLOAD);
 }
 
-void print_leaf_node(void* node) {
-  uint32_t num_cells = *leaf_node_num_cells(node);
-  printf("leaf (size %d)\n", num_cells);
-  for (uint32_t i = 0; i < num_cells; i++) {
-    uint32_t key = *leaf_node_key(node, i);
-    printf("  - %d : %d\n", i, key);
+void indent(uint32_t level) {
+  for (uint32_t i = 0; i < level; i++) {
+    printf("  ");
+  }
+}
+
+void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
+  // keep the node resident while its children are printed
+  void* node = pager_pin(pager, page_num);
+  uint32_t num_keys, child;
+  switch (get_node_type(node)) {
+    case (NODE_LEAF):
+      num_keys = *leaf_node_num_cells(node);
+      indent(indentation_level);
+      printf("- leaf (size %d)\n", num_keys);
+      for (uint32_t i = 0; i < num_keys; i++) {
+        indent(indentation_level + 1);
+        printf("- %" PRIu64 "\n", *leaf_node_key(node, i));
+      }
+      break;
+    case (NODE_INTERNAL):
+      num_keys = *internal_node_num_keys(node);
+      indent(indentation_level);
+      printf("- internal (size %d)\n", num_keys);
+      if (num_keys > 0) {
+        for (uint32_t i = 0; i < num_keys; i++) {
+          child = *internal_node_child(node, i);
+          print_tree(pager, child, indentation_level + 1);
+          indent(indentation_level + 1);
+          printf("- key %" PRIu64 "\n", internal_node_key(node, i));
+        }
+        child = *internal_node_right_child(node);
+        print_tree(pager, child, indentation_level + 1);
+      }
+      break;
+    case (NODE_OVERFLOW):
+      // only reached through a leaf cell, never as a child
+      indent(indentation_level);
+      printf("- overflow (next %d)\n", *overflow_next_page(node));
+      break;
+    case (NODE_FREE):
+      indent(indentation_level);
+      printf("- free (next %d)\n", *free_page_next(node));
+      break;
   }
+  pager_unpin(pager, page_num);
+}
+
+
+// the cursors and other short lived memory of this thread's statement
+static __thread Arena statement_arena;
+
+static Cursor* cursor_alloc(void){
+    return arena_alloc(&statement_arena, sizeof(Cursor));
+}
+
+void statement_arena_reset(void){
+    arena_reset(&statement_arena);
+}
+
+// for threads that ran statements and are about to exit
+void statement_arena_release(void){
+    arena_release(&statement_arena);
 }
 
+/*
+    Where the current statement of this thread spent its time, for the
+    slow statement log: prepare_statement fills in text and prepare_nsec,
+    the rest adds up while execute_statement runs.
+*/
+typedef struct {
+    char text[SLOW_LOG_MAX_TEXT];
+    uint64_t prepare_nsec;
+    uint64_t io_nsec;
+    uint64_t split_nsec;
+    uint64_t commit_nsec;
+    uint64_t output_nsec;
+    uint32_t pages_touched;
+    uint32_t pages_read;
+} StatementTrace;
+
+static __thread StatementTrace statement_trace;
 
 Table *db_open(const char* filename)
 {
-    Pager* pager = pager_open(filename);
-    uint32_t num_rows = pager->file_length/ROW_SIZE;
+    PagerConfig config = {.mode = PAGER_MODE_BUFFERED, .num_frames = PAGER_DEFAULT_FRAMES,
+                          .use_wal = true, .group_commit_size = WAL_GROUP_COMMIT_SIZE};
+    return db_open_with_config(filename, &config);
+}
+
+Table *db_open_with_config(const char* filename, const PagerConfig* config)
+{
+    Pager* pager = pager_open(filename, config);
     Table * table = malloc(sizeof(Table));
     table->pager  = pager;
-    table->root_page_num = 0;
+    // recursive: a bulk load falls back to single inserts
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&table->writer, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    table->num_write_latches = 0;
+    table->in_transaction = false;
+    table->defer_sync = false;
+    memset(&table->plans, 0, sizeof(PlanCache));
+    memset(&table->stats, 0, sizeof(TableStats));
+    table->slow_log_nsec = 0;
+    table->slow_log = NULL;
+    table->slow_log_file = NULL;
+    pthread_mutex_init(&table->plans.mutex, NULL);
     if(pager->num_pages==0){
-        // New database file .Initialize page 0 as leaf node
-        void* root_node = get_page(pager,0);
+        // New database file: the header, then an empty root leaf on page 1
+        void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+        *db_header_magic(header) = DB_HEADER_MAGIC;
+        *db_header_root_page(header) = DB_HEADER_PAGE_NUM + 1;
+        *db_header_freelist_head(header) = 0;
+        *db_header_free_pages(header) = 0;
+        pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+        void* root_node = get_page(pager, DB_HEADER_PAGE_NUM + 1);
         initialize_leaf_node(root_node);
+        set_node_root(root_node, true);
+        pager_mark_dirty(pager, DB_HEADER_PAGE_NUM + 1);
+    }
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    if (*db_header_magic(header) != DB_HEADER_MAGIC) {
+        printf("Db file has no valid header. Corrupt file.\n");
+        exit(EXIT_FAILURE);
     }
+    table->root_page_num = *db_header_root_page(header);
     return table;
 }
 
-void leaf_node_insert(Cursor* cursor,uint32_t key, Row* value){
-    void* node = get_page(cursor->table->pager,cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    if(num_cells>=LEAF_NODE_MAX_CELLS){
-        leaf_node_split_and_insert(cursor,key,value);
+void leaf_node_insert(Cursor* cursor,uint64_t key, Row* value){
+    Pager* pager = cursor->table->pager;
+    // built before the leaf is fetched: a spilled payload allocates pages
+    uint8_t cell[LEAF_NODE_MAX_CELL_SIZE];
+    uint32_t cell_size = leaf_node_build_cell(cursor->table, value, cell);
+    void* node = get_page(pager,cursor->page_num);
+    if(leaf_node_free_space(node) < cell_size + LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE){
+        uint64_t start = stats_now_nsec();
+        leaf_node_split_and_insert(cursor,key,cell,cell_size);
+        statement_trace.split_nsec += stats_now_nsec() - start;
         return;
     }
-    if(cursor->cell_num < num_cells){
-        for(uint32_t i=num_cells; i>cursor->cell_num;--i){
-            memcpy(leaf_node_cell(node,i),leaf_node_cell(node,i-1),LEAF_NODE_CELL_SIZE);
+    pager_mark_dirty(pager, cursor->page_num);
+    leaf_node_insert_cell(node, cursor->cell_num, key, cell, cell_size);
+}
+
+
+/*
+    Mapped mode: the kernel page cache is the buffer pool. The whole
+    reserve is mapped up front (pages past EOF are never touched) so
+    growing the file only needs an ftruncate, and the pointers handed
+    out by get_page never move.
+*/
+static void pager_map_file(Pager* pager, size_t reserve){
+    if (reserve == 0)
+        reserve = PAGER_MMAP_DEFAULT_RESERVE;
+    if ((size_t)pager->file_length > reserve)
+        reserve = pager->file_length;
+    pager->map = mmap(NULL, reserve, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      pager->file_descriptor, 0);
+    if (pager->map == MAP_FAILED) {
+        printf("Error mapping db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->map_reserve = reserve;
+}
+
+static void pager_grow_map(Pager* pager, uint32_t page_num){
+    off_t new_length = ((off_t)page_num / PAGER_MMAP_GROW_PAGES + 1)
+                       * PAGER_MMAP_GROW_PAGES * PAGE_SIZE;
+    if ((size_t)new_length > pager->map_reserve) {
+        // try to extend the reservation in place, moving it would
+        // invalidate every page pointer callers are holding
+        void* map = mremap(pager->map, pager->map_reserve, pager->map_reserve * 2, 0);
+        if (map == MAP_FAILED) {
+            printf("Db file outgrew the mmap reserve of %zu bytes\n", pager->map_reserve);
+            exit(EXIT_FAILURE);
         }
+        pager->map_reserve *= 2;
+    }
+    if (ftruncate(pager->file_descriptor, new_length) == -1) {
+        printf("Error growing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
-    *(leaf_node_num_cells(node))+=1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    pager->file_length = new_length;
+}
+
+static void* pager_mapped_page(Pager* pager, uint32_t page_num){
+    if ((off_t)(page_num + 1) * PAGE_SIZE > pager->file_length)
+        pager_grow_map(pager, page_num);
+    if (page_num >= pager->num_pages)
+        pager->num_pages = page_num + 1;
+    pager->stats.hits++;
+    return pager->map + (size_t)page_num * PAGE_SIZE;
 }
 
+static void pager_unmap_file(Pager* pager){
+    if (msync(pager->map, pager->file_length, MS_SYNC) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    munmap(pager->map, pager->map_reserve);
+    pager->map = NULL;
+    // drop the unused tail of the last growth chunk
+    if (ftruncate(pager->file_descriptor, (off_t)pager->num_pages * PAGE_SIZE) == -1) {
+        printf("Error truncating db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
 
-Pager* pager_open(const char* filename){
-    int fd = open(filename,O_RDWR|O_CREAT|S_IWUSR|S_IRUSR);
+Pager* pager_open(const char* filename, const PagerConfig* config){
+    // a mapped file is the kernel's page cache, it cannot bypass it
+    bool direct_io = config->direct_io && config->mode == PAGER_MODE_BUFFERED;
+    int fd = open(filename,O_RDWR|O_CREAT|(direct_io ? O_DIRECT : 0),S_IWUSR|S_IRUSR);
+    if (fd==-1 && direct_io && errno == EINVAL){
+        // the file system has no direct I/O, tmpfs for one
+        direct_io = false;
+        fd = open(filename,O_RDWR|O_CREAT,S_IWUSR|S_IRUSR);
+    }
     if (fd==-1){
         printf(" Unable to open file with name %s \n",filename);
         exit(EXIT_FAILURE);
     }
-    off_t file_length = lseek(fd,0,SEEK_END);
     Pager* pager =  malloc(sizeof(Pager));
+    pager->direct_io = direct_io;
+    pager->ring = NULL;
+    // without io_uring in the kernel the pager uses plain system calls
+    if (config->io == PAGER_IO_URING && config->mode == PAGER_MODE_BUFFERED)
+        pager->ring = io_ring_open(IO_RING_ENTRIES);
+    pager->wal = NULL;
+    pager->wal_path = NULL;
+    // a mapped file is written through the kernel, so it cannot use the log
+    if (config->use_wal && config->mode == PAGER_MODE_BUFFERED) {
+        pager->wal_path = malloc(strlen(filename) + 5);
+        sprintf(pager->wal_path, "%s-wal", filename);
+        pager->wal = wal_open(pager->wal_path, PAGE_SIZE, config->group_commit_size);
+        pager->wal->ring = pager->ring;
+        // recovery: committed frames left by a crash go into the file first
+        wal_checkpoint(pager->wal, fd);
+    }
+    off_t file_length = lseek(fd,0,SEEK_END);
     pager->file_descriptor = fd;
     pager->file_length = file_length;
     pager->num_pages =  (file_length/PAGE_SIZE);
@@ -80,320 +280,3161 @@ Pager* pager_open(const char* filename){
         printf("Db file is not a whole number of pages. Corrupt file.\n");
         exit(EXIT_FAILURE);
     }
-    for (uint32_t i =0 ;i<TABLE_MAX_PAGES;i++)
-        pager->pages[i]=NULL;
+    pager->mode = config->mode;
+    pager->map = NULL;
+    pager->map_reserve = 0;
+    pager->last_commit = 0;
+    pager->versions = version_store_open(PAGE_SIZE);
+    memset(&pager->stats, 0, sizeof(PagerStats));
+    // recursive: a commit can checkpoint, which fetches pages
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&pager->mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    if (pager->mode == PAGER_MODE_MMAP)
+        pager_map_file(pager, config->mmap_reserve);
+    uint32_t num_frames = config->num_frames;
+    if (num_frames == 0) {
+        num_frames = PAGER_DEFAULT_FRAMES;
+    }
+    // a split holds a few unpinned node pointers per tree level
+    if (num_frames < PAGER_MIN_FRAMES) {
+        num_frames = PAGER_MIN_FRAMES;
+    }
+    pager->num_frames = num_frames;
+    pager->frames_used = 0;
+    pager->frame_data = NULL;
+    if (pager->mode == PAGER_MODE_BUFFERED)
+        pager->frame_data = page_slab_alloc(num_frames, PAGE_SIZE);
+    pager->frames = malloc(num_frames * sizeof(Frame));
+    // keep the hash chains short: at least two buckets per frame
+    pager->num_buckets = 1;
+    while (pager->num_buckets < num_frames * 2)
+        pager->num_buckets <<= 1;
+    pager->buckets = malloc(pager->num_buckets * sizeof(uint32_t));
+    if ((pager->mode == PAGER_MODE_BUFFERED && pager->frame_data == NULL) ||
+        pager->frames == NULL || pager->buckets == NULL) {
+        printf("Unable to allocate buffer pool of %d frames\n", num_frames);
+        exit(EXIT_FAILURE);
+    }
+    // readers come and go on the upper levels all the time, a latch that
+    // let new readers in ahead of a waiting writer would starve it
+    pthread_rwlockattr_t latch_attributes;
+    pthread_rwlockattr_init(&latch_attributes);
+    pthread_rwlockattr_setkind_np(&latch_attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    for (uint32_t i = 0; i < num_frames; i++) {
+        Frame* frame = &pager->frames[i];
+        frame->data = NULL;
+        if (pager->frame_data != NULL)
+            frame->data = pager->frame_data + (size_t)i * PAGE_SIZE;
+        frame->in_use = false;
+        frame->dirty = false;
+        frame->pin_count = 0;
+        frame->lru_prev = frame->lru_next = frame->hash_next = INVALID_FRAME;
+        pthread_rwlock_init(&frame->latch, &latch_attributes);
+    }
+    pthread_rwlockattr_destroy(&latch_attributes);
+    for (uint32_t i = 0; i < pager->num_buckets; i++)
+        pager->buckets[i] = INVALID_FRAME;
+    pager->lru_head = pager->lru_tail = INVALID_FRAME;
     return pager;
 }
 
-void* get_page(Pager* pager,uint32_t page_num){
-    if(page_num> TABLE_MAX_PAGES){
-        printf("Tried to fetch a page number that is out of bound %d > %d \n",page_num,TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
-    }
-    if (pager->pages[page_num]==NULL){
-        // Cache miss. Allocate memory and load from file.
-        void* page = malloc(sizeof(PAGE_SIZE));
-        uint32_t num_pages = pager->file_length/PAGE_SIZE;
-        if (pager->file_length % PAGE_SIZE) {num_pages += 1;}
-        if (page_num <= num_pages) {
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                printf("Error reading file: %d\n", errno);
-               exit(EXIT_FAILURE);
-                }
-        }
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
-        }
-    }   
-    return pager->pages[page_num]; 
+static uint32_t pager_bucket(Pager* pager, uint32_t page_num){
+    return (page_num * 2654435761u) & (pager->num_buckets - 1);
 }
 
-void pager_flush(Pager* pager, uint32_t page_num) {
-  if (pager->pages[page_num] == NULL) {
-    printf("Tried to flush null page\n");
-    exit(EXIT_FAILURE);
-  }
+static uint32_t pager_lookup(Pager* pager, uint32_t page_num){
+    uint32_t index = pager->buckets[pager_bucket(pager, page_num)];
+    while (index != INVALID_FRAME && pager->frames[index].page_num != page_num)
+        index = pager->frames[index].hash_next;
+    return index;
+}
+
+static void pager_hash_remove(Pager* pager, uint32_t frame_index){
+    uint32_t* link = &pager->buckets[pager_bucket(pager, pager->frames[frame_index].page_num)];
+    while (*link != frame_index)
+        link = &pager->frames[*link].hash_next;
+    *link = pager->frames[frame_index].hash_next;
+}
 
-  off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+static void lru_unlink(Pager* pager, uint32_t frame_index){
+    Frame* frame = &pager->frames[frame_index];
+    if (frame->lru_prev != INVALID_FRAME)
+        pager->frames[frame->lru_prev].lru_next = frame->lru_next;
+    else
+        pager->lru_head = frame->lru_next;
+    if (frame->lru_next != INVALID_FRAME)
+        pager->frames[frame->lru_next].lru_prev = frame->lru_prev;
+    else
+        pager->lru_tail = frame->lru_prev;
+    frame->lru_prev = frame->lru_next = INVALID_FRAME;
+}
 
-  if (offset == -1) {
-    printf("Error seeking: %d\n", errno);
-    exit(EXIT_FAILURE);
-  }
+static void lru_push_front(Pager* pager, uint32_t frame_index){
+    Frame* frame = &pager->frames[frame_index];
+    frame->lru_prev = INVALID_FRAME;
+    frame->lru_next = pager->lru_head;
+    if (pager->lru_head != INVALID_FRAME)
+        pager->frames[pager->lru_head].lru_prev = frame_index;
+    pager->lru_head = frame_index;
+    if (pager->lru_tail == INVALID_FRAME)
+        pager->lru_tail = frame_index;
+}
 
-  ssize_t bytes_written =
-      write(pager->file_descriptor, pager->pages[page_num],PAGE_SIZE);
+// frames without a page wait at the tail to be taken first
+static void lru_push_back(Pager* pager, uint32_t frame_index){
+    Frame* frame = &pager->frames[frame_index];
+    frame->lru_next = INVALID_FRAME;
+    frame->lru_prev = pager->lru_tail;
+    if (pager->lru_tail != INVALID_FRAME)
+        pager->frames[pager->lru_tail].lru_next = frame_index;
+    pager->lru_tail = frame_index;
+    if (pager->lru_head == INVALID_FRAME)
+        pager->lru_head = frame_index;
+}
 
-  if (bytes_written == -1) {
-    printf("Error writing: %d\n", errno);
-    exit(EXIT_FAILURE);
-  }
+// pages written out, each of bytes_per_page bytes on disk
+static void pager_count_writes(Pager* pager, uint32_t count, size_t bytes_per_page){
+    pager->stats.pages_written += count;
+    pager->stats.bytes_flushed += (uint64_t)count * bytes_per_page;
 }
 
-void db_close(Table* table){
-    Pager* pager = table->pager;
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
-        }
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+static void pager_write_frame(Pager* pager, Frame* frame){
+    TRACE_PROBE2(page_flush, frame->page_num, 1);
+    uint64_t start = stats_now_nsec();
+    if (pager->wal != NULL) {
+        // never overwrite the file before a checkpoint, the page may be
+        // part of a transaction that has not committed yet
+        wal_append(pager->wal, frame->page_num, frame->data, 0);
+        pager_count_writes(pager, 1, sizeof(WalFrameHeader) + PAGE_SIZE);
+        statement_trace.io_nsec += stats_now_nsec() - start;
+        frame->dirty = false;
+        return;
     }
-    
-    int result = close(pager->file_descriptor);
-    if (result == -1) {
-        printf("Error closing db file.\n");
+    off_t offset = (off_t)frame->page_num * PAGE_SIZE;
+    ssize_t bytes_written = pwrite(pager->file_descriptor, frame->data, PAGE_SIZE, offset);
+    if (bytes_written != PAGE_SIZE) {
+        printf("Error writing: %d\n", errno);
         exit(EXIT_FAILURE);
     }
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        void* page = pager->pages[i];
-        if (page) {
-            free(page);
-            pager->pages[i] = NULL;
-       }
+    pager_count_writes(pager, 1, PAGE_SIZE);
+    statement_trace.io_nsec += stats_now_nsec() - start;
+    // an evicted page past the old end of file must be read back next time
+    if (offset + PAGE_SIZE > pager->file_length) {
+        pager->file_length = offset + PAGE_SIZE;
     }
-    free(pager);
-    free(table);
+    frame->dirty = false;
 }
 
-void free_table(Table *table)
-{
-    for (uint32_t i = 0; table->pager->pages[i]; i++)
-    {
-        free(table->pager->pages[i]);
+static uint32_t pager_evict(Pager* pager){
+    // walk from the least recently used end, skipping pinned frames
+    uint32_t index = pager->lru_tail;
+    while (index != INVALID_FRAME && pager->frames[index].pin_count > 0)
+        index = pager->frames[index].lru_prev;
+    if (index == INVALID_FRAME) {
+        printf("Buffer pool exhausted: all %d frames are pinned\n", pager->num_frames);
+        exit(EXIT_FAILURE);
     }
-    free(table);
+    Frame* victim = &pager->frames[index];
+    lru_unlink(pager, index);
+    // a frame truncated away by pager_truncate holds no page
+    if (!victim->in_use)
+        return index;
+    if (victim->dirty)
+        pager_write_frame(pager, victim);
+    pager_hash_remove(pager, index);
+    victim->in_use = false;
+    if (pager->mode == PAGER_MODE_BUFFERED)
+        pager->stats.evictions++;
+    return index;
 }
 
-void serialize_row(Row *source, void *destination)
-{
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    memcpy(destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
-    memcpy(destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
+/*
+    Take a frame for page_num, a free one or the least recently used,
+    and enter it in the table. Its data is left for the caller to load.
+*/
+static uint32_t pager_claim_frame(Pager* pager, uint32_t page_num){
+    uint32_t index;
+    if (pager->frames_used < pager->num_frames)
+        index = pager->frames_used++;
+    else
+        index = pager_evict(pager);
+    Frame* frame = &pager->frames[index];
+    frame->page_num = page_num;
+    frame->pin_count = 0;
+    frame->in_use = true;
+    frame->dirty = false;
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+    uint32_t bucket = pager_bucket(pager, page_num);
+    frame->hash_next = pager->buckets[bucket];
+    pager->buckets[bucket] = index;
+    lru_push_front(pager, index);
+    return index;
 }
 
-void deserialize_row(void *source, Row *destination)
-{
-    memcpy(&(destination->id), source + ID_SIZE, ID_OFFSET);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+static uint32_t pager_fetch(Pager* pager, uint32_t page_num){
+    statement_trace.pages_touched++;
+    uint32_t index = pager_lookup(pager, page_num);
+    if (index != INVALID_FRAME) {
+        pager->stats.hits++;
+        lru_unlink(pager, index);
+        lru_push_front(pager, index);
+        // a vacuum hands out pages again that may still be cached
+        if (page_num >= pager->num_pages)
+            pager->num_pages = page_num + 1;
+        return index;
+    }
+    // Cache miss. Take a free frame (or evict one) and load from file.
+    index = pager_claim_frame(pager, page_num);
+    Frame* frame = &pager->frames[index];
+    // after the claim: writing out a victim can grow the file
+    uint32_t num_pages = pager->file_length/PAGE_SIZE;
+    if (pager->mode == PAGER_MODE_MMAP) {
+        // a mapped frame only holds the latch, the page is the mapping
+        frame->data = pager_mapped_page(pager, page_num);
+        return index;
+    }
+    uint64_t start = stats_now_nsec();
+    if (pager->wal != NULL && wal_read_page(pager->wal, page_num, frame->data)) {
+        // the latest image of this page is still in the log
+        pager->stats.misses++;
+        pager->stats.pages_read++;
+    } else if (page_num < num_pages) {
+        pager->stats.misses++;
+        pager->stats.pages_read++;
+        ssize_t bytes_read = pread(pager->file_descriptor, frame->data, PAGE_SIZE,
+                                   (off_t)page_num * PAGE_SIZE);
+        if (bytes_read == -1) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        // page past the end of the file, it only exists in memory until flushed
+        pager->stats.misses++;
+        memset(frame->data, 0, PAGE_SIZE);
+        frame->dirty = true;
+        return index;
+    }
+    statement_trace.io_nsec += stats_now_nsec() - start;
+    statement_trace.pages_read++;
+    TRACE_PROBE1(page_read, page_num);
+    return index;
 }
 
+/*
+    get_page hands out unpinned pointers that callers keep using across
+    a few more fetches. Once other threads fetch pages too, LRU order
+    alone cannot keep those frames resident, so the last
+    PAGER_RECENT_PINS pages a thread got from get_page stay pinned until
+    it calls pager_unpin_recent, which every statement ends with. A pool
+    shared by n threads needs more than n * PAGER_RECENT_PINS frames.
+*/
+typedef struct {
+    Pager* pager;
+    uint32_t page_num;
+} RecentPin;
 
+static __thread RecentPin recent_pins[PAGER_RECENT_PINS];
+static __thread uint32_t next_recent_pin;
 
-void* cursor_value(Cursor* cursor){
-    uint32_t page_num = cursor->page_num;
-    void* page = get_page(cursor->table->pager, page_num);
-    return leaf_node_value(page, cursor->cell_num);
-}
-
-void advance_cursor(Cursor* cursor){
-    uint32_t page_num = cursor->page_num;
-    void* node = get_page(cursor->table->pager, page_num);
-    cursor->cell_num += 1;
-    if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-        cursor->end_of_table = true;
+static void pager_unpin_frame(Pager* pager, uint32_t page_num){
+    uint32_t index = pager_lookup(pager, page_num);
+    if (index == INVALID_FRAME || pager->frames[index].pin_count == 0) {
+        printf("Tried to unpin page %d which is not pinned\n", page_num);
+        exit(EXIT_FAILURE);
     }
+    pager->frames[index].pin_count--;
 }
 
-MetaCommandResult do_meta_command(InputBuffer *input_buffer,Table* table)
-{
-    if (strcmp(input_buffer->buffer, TERMINATE_CMD) == 0)
-    {
-        close_input_buffer(input_buffer);
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-        printf("Tree:\n");
-        print_leaf_node(get_page(table->pager, 0));
-        return META_COMMAND_SUCCESS;
-    }else if (strcmp(input_buffer->buffer, ".constants") == 0) {
-       printf("Constants:\n");
-       print_constants();
-       return META_COMMAND_SUCCESS;
-   }
-    return META_COMMAND_UNRECOGNIZED_COMMAND;
+void* get_page(Pager* pager,uint32_t page_num){
+    pthread_mutex_lock(&pager->mutex);
+    if (pager->mode == PAGER_MODE_MMAP) {
+        // mapped pages never move, there is nothing to pin
+        void* page = pager_mapped_page(pager, page_num);
+        pthread_mutex_unlock(&pager->mutex);
+        return page;
+    }
+    Frame* frame = &pager->frames[pager_fetch(pager, page_num)];
+    frame->pin_count++;
+    RecentPin oldest = recent_pins[next_recent_pin];
+    recent_pins[next_recent_pin].pager = pager;
+    recent_pins[next_recent_pin].page_num = page_num;
+    next_recent_pin = (next_recent_pin + 1) % PAGER_RECENT_PINS;
+    if (oldest.pager == pager)
+        pager_unpin_frame(pager, oldest.page_num);
+    pthread_mutex_unlock(&pager->mutex);
+    // a pin on another pager is dropped without holding two pager locks
+    if (oldest.pager != NULL && oldest.pager != pager)
+        pager_unpin(oldest.pager, oldest.page_num);
+    return frame->data;
 }
 
-PrepareResult prepare_statement(InputBuffer *input_buffer, Statement *statement)
-{
-    if (strncmp(input_buffer->buffer, "insert", 6) == 0)
-    {
-        statement->type = STATEMENT_INSERT;
-        int args_count = sscanf(input_buffer->buffer, "insert %d %s %s", &statement->row_to_insert.id,
-                                statement->row_to_insert.username, statement->row_to_insert.email);
-        if (args_count < 3)
-        {
-            return PREPARE_SYNTAX_ERROR;
+// drop the pins get_page holds on pager for the calling thread
+void pager_unpin_recent(Pager* pager){
+    if (pager->mode == PAGER_MODE_MMAP)
+        return;
+    // readers latch their pages and mostly hold none of these
+    bool holding = false;
+    for (uint32_t i = 0; i < PAGER_RECENT_PINS && !holding; i++)
+        holding = recent_pins[i].pager == pager;
+    if (!holding)
+        return;
+    pthread_mutex_lock(&pager->mutex);
+    for (uint32_t i = 0; i < PAGER_RECENT_PINS; i++) {
+        if (recent_pins[i].pager == pager) {
+            pager_unpin_frame(pager, recent_pins[i].page_num);
+            recent_pins[i].pager = NULL;
         }
-        return PREPARE_SUCCESS;
     }
-    if (strcmp(input_buffer->buffer, "select") == 0)
-    {
-        statement->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
-    }
-    return PREPARE_UNRECOGNIZED_STATEMENT;
+    pthread_mutex_unlock(&pager->mutex);
 }
 
-ExecuteResult execute_insert(Statement *statement, Table *table)
-{
-    void* node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = (*leaf_node_num_cells(node));
-    Row *row_to_insert = &(statement->row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id;
-    Cursor* cursor = table_find(table,key_to_insert);
-    if(cursor->cell_num < num_cells){
-        uint32_t key_at_index = *(leaf_node_key(node,cursor->cell_num));
-        if(key_at_index==key_to_insert){
-            return EXECUTE_DUPLICATE_KEY;
-        }
+/*
+    Callers that write through a page pointer must mark the page dirty,
+    only dirty pages are written back on eviction, commit and flush.
+*/
+void pager_mark_dirty(Pager* pager, uint32_t page_num){
+    if (pager->mode == PAGER_MODE_MMAP)
+        return;
+    pthread_mutex_lock(&pager->mutex);
+    uint32_t index = pager_lookup(pager, page_num);
+    if (index == INVALID_FRAME) {
+        printf("Tried to mark page %d dirty which is not cached\n", page_num);
+        exit(EXIT_FAILURE);
     }
-    free(cursor);
-    return EXECUTE_SUCCESS;
+    pager->frames[index].dirty = true;
+    pthread_mutex_unlock(&pager->mutex);
 }
 
-ExecuteResult execute_select(Statement *statement, Table *table)
-{
-    Cursor* cursor = table_start(table);
-    Row row;
-    while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+/*
+    Pinned pages are never evicted. Every pager_pin must be
+    matched by a pager_unpin once the caller drops the pointer.
+*/
+void* pager_pin(Pager* pager, uint32_t page_num){
+    pthread_mutex_lock(&pager->mutex);
+    void* page;
+    if (pager->mode == PAGER_MODE_MMAP) {
+        page = pager_mapped_page(pager, page_num);
+    } else {
+        Frame* frame = &pager->frames[pager_fetch(pager, page_num)];
+        frame->pin_count++;
+        page = frame->data;
     }
-    free(cursor);
-    return EXECUTE_SUCCESS;
+    pthread_mutex_unlock(&pager->mutex);
+    return page;
 }
 
-ExecuteResult execute_statement(Statement *statement, Table *table)
-{
-    switch (statement->type)
-    {
-    case STATEMENT_INSERT:
-        return execute_insert(statement, table);
-    case STATEMENT_SELECT:
-        return execute_select(statement, table);
-    }
+void pager_unpin(Pager* pager, uint32_t page_num){
+    if (pager->mode == PAGER_MODE_MMAP)
+        return;
+    pthread_mutex_lock(&pager->mutex);
+    pager_unpin_frame(pager, page_num);
+    pthread_mutex_unlock(&pager->mutex);
 }
 
+/*
+    Page latches. A latched page is pinned too, so its frame and latch
+    stay with it until pager_unlatch. Readers take shared latches and
+    the one writer exclusive ones, see table_seek and
+    table_latch_for_write. In mapped mode frames are only latch slots.
+*/
+void* pager_latch(Pager* pager, uint32_t page_num, LatchMode mode){
+    pthread_mutex_lock(&pager->mutex);
+    Frame* frame = &pager->frames[pager_fetch(pager, page_num)];
+    frame->pin_count++;
+    pthread_mutex_unlock(&pager->mutex);
+    // blocking on the latch must not hold up the pool
+    if (mode == LATCH_SHARED)
+        pthread_rwlock_rdlock(&frame->latch);
+    else
+        pthread_rwlock_wrlock(&frame->latch);
+    return frame->data;
+}
 
-Cursor* table_start(Table* table){
-    Cursor* cursor =  malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = table->root_page_num;
-    void* root_node = get_page(table->pager,table->root_page_num);
-    uint32_t num_cells = *leaf_node_num_cells(root_node);
-    cursor->end_of_table = (num_cells==0);
-    return cursor;
+// pager_latch that gives up and returns NULL instead of waiting, or
+// when page_num is not a page of the database
+void* pager_try_latch(Pager* pager, uint32_t page_num, LatchMode mode){
+    pthread_mutex_lock(&pager->mutex);
+    if (page_num >= pager->num_pages) {
+        pthread_mutex_unlock(&pager->mutex);
+        return NULL;
+    }
+    Frame* frame = &pager->frames[pager_fetch(pager, page_num)];
+    frame->pin_count++;
+    pthread_mutex_unlock(&pager->mutex);
+    int result = mode == LATCH_SHARED ? pthread_rwlock_tryrdlock(&frame->latch)
+                                      : pthread_rwlock_trywrlock(&frame->latch);
+    if (result == 0)
+        return frame->data;
+    pager_unpin(pager, page_num);
+    return NULL;
 }
 
-Cursor* table_find(Table* table,uint32_t key){
-    //Return the position of the given key.
-    // the key is not present, 
-    // return the positionwhere it should be inserted
-    uint32_t root_page_num =  table->root_page_num;
-    void* root_node = get_page(table->pager,root_page_num);
-    if (get_node_type(root_node)==NODE_LEAF){
-        return leaf_node_find(table, root_page_num, key);
-    }else{
-        printf("Need to implement searching internal nodes");
+void pager_unlatch(Pager* pager, uint32_t page_num){
+    pthread_mutex_lock(&pager->mutex);
+    uint32_t index = pager_lookup(pager, page_num);
+    if (index == INVALID_FRAME || pager->frames[index].pin_count == 0) {
+        printf("Tried to unlatch page %d which is not latched\n", page_num);
         exit(EXIT_FAILURE);
     }
+    pthread_rwlock_unlock(&pager->frames[index].latch);
+    pager->frames[index].pin_count--;
+    pthread_mutex_unlock(&pager->mutex);
 }
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key)
-{
-  void* node = get_page(table->pager, page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+/*
+    Snapshots. A snapshot reads the database as of the last commit when
+    it began. The writer keeps a page's committed image in the version
+    store before it first changes the page while snapshots are open (see
+    table_latch_for_write), and the store drops images once no open
+    snapshot is old enough to read them.
+*/
+uint64_t pager_begin_snapshot(Pager* pager){
+    pthread_mutex_lock(&pager->mutex);
+    uint64_t snapshot = pager->last_commit;
+    version_store_add_snapshot(pager->versions, snapshot);
+    pthread_mutex_unlock(&pager->mutex);
+    return snapshot;
+}
 
-  Cursor* cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
-  cursor->page_num = page_num;
+void pager_end_snapshot(Pager* pager, uint64_t snapshot){
+    pthread_mutex_lock(&pager->mutex);
+    version_store_remove_snapshot(pager->versions, snapshot);
+    pthread_mutex_unlock(&pager->mutex);
+}
 
-  // Binary search
-  uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
-  while (one_past_max_index != min_index) {
-    uint32_t index = ( one_past_max_index+min_index ) / 2; // ??  overflow
-    uint32_t key_at_index = *leaf_node_key(node, index);
-    if (key == key_at_index) {
-        // set the cursor to the current position before returning it 
-        cursor->cell_num = index;
-        return cursor;
-    }
-    // follow the normal binary search algorithm based
-    // on where the condition fall to whether mid-1 of mid + 1
-    if (key < key_at_index) { 
-        one_past_max_index = index;
-    } else {
-        min_index = index + 1;
+/*
+    Copy page_num as of commit snapshot into buffer. The live page is
+    latched shared while the store is searched, so the writer cannot
+    begin changing it without the version being found. An image the
+    snapshot needs is never dropped while it is open, it is copied
+    outside the pool mutex.
+*/
+void pager_read_snapshot(Pager* pager, uint64_t snapshot, uint32_t page_num, void* buffer){
+    void* page = pager_latch(pager, page_num, LATCH_SHARED);
+    pthread_mutex_lock(&pager->mutex);
+    const void* version = version_store_find(pager->versions, page_num, snapshot);
+    pthread_mutex_unlock(&pager->mutex);
+    memcpy(buffer, version != NULL ? version : page, PAGE_SIZE);
+    pager_unlatch(pager, page_num);
+}
+
+// keep the committed image of a page the open transaction is about to change
+void pager_save_version(Pager* pager, uint32_t page_num, const void* page){
+    pthread_mutex_lock(&pager->mutex);
+    version_store_save(pager->versions, page_num, pager->last_commit + 1, page);
+    pthread_mutex_unlock(&pager->mutex);
+}
+
+void pager_flush(Pager* pager, uint32_t page_num) {
+  if (pager->mode == PAGER_MODE_MMAP) {
+    if (msync(pager->map + (size_t)page_num * PAGE_SIZE, PAGE_SIZE, MS_SYNC) == -1) {
+      printf("Error syncing page %d: %d\n", page_num, errno);
+      exit(EXIT_FAILURE);
     }
+    return;
+  }
+  pthread_mutex_lock(&pager->mutex);
+  uint32_t index = pager_lookup(pager, page_num);
+  if (index == INVALID_FRAME) {
+    printf("Tried to flush null page\n");
+    exit(EXIT_FAILURE);
   }
+  pager_write_frame(pager, &pager->frames[index]);
+  pthread_mutex_unlock(&pager->mutex);
+}
 
-  cursor->cell_num = min_index;
-  return cursor;
+static int compare_page_nums(const void* a, const void* b){
+    uint32_t left = *(const uint32_t*)a;
+    uint32_t right = *(const uint32_t*)b;
+    return (left > right) - (left < right);
 }
 
-NodeType get_node_type(void* node){
-    uint32_t value =  (*(uint8_t*)node + NODE_TYPE_OFFSET);
-    return (NodeType)value;
+static void pager_ring_submit(Pager* pager){
+    if (!io_ring_submit(pager->ring)) {
+        printf("Error in batched page I/O: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
 }
 
-void set_node_type(void* node,NodeType type){
-    uint8_t value = type;
-    (*(uint8_t*)(node+NODE_TYPE_OFFSET)) = value;
+/*
+    Read-ahead into the buffer pool itself, for a pager with a ring or
+    one whose file bypasses the kernel's cache: missing pages get frames
+    and are read with one submit. The frames stay pinned until their
+    reads are done, so a later page of the batch cannot evict them.
+*/
+static void pager_read_ahead(Pager* pager, uint32_t* page_nums, uint32_t count){
+    uint32_t file_pages = pager->file_length / PAGE_SIZE;
+    uint32_t claimed[IO_RING_ENTRIES];
+    uint32_t num_claimed = 0;
+    for (uint32_t i = 0; i <= count; i++) {
+        if (num_claimed == IO_RING_ENTRIES || (i == count && num_claimed > 0)) {
+            if (pager->ring != NULL)
+                pager_ring_submit(pager);
+            for (uint32_t j = 0; j < num_claimed; j++)
+                pager->frames[claimed[j]].pin_count--;
+            num_claimed = 0;
+        }
+        if (i == count)
+            break;
+        uint32_t page_num = page_nums[i];
+        if (page_num >= file_pages || pager_lookup(pager, page_num) != INVALID_FRAME)
+            continue;
+        uint32_t index = pager_claim_frame(pager, page_num);
+        Frame* frame = &pager->frames[index];
+        frame->pin_count++;
+        claimed[num_claimed++] = index;
+        pager->stats.prefetches++;
+        pager->stats.pages_read++;
+        TRACE_PROBE1(page_prefetch, page_num);
+        off_t offset = (off_t)page_num * PAGE_SIZE;
+        if (pager->wal != NULL && wal_read_page(pager->wal, page_num, frame->data))
+            continue;
+        if (pager->ring != NULL) {
+            io_ring_read(pager->ring, pager->file_descriptor, frame->data, PAGE_SIZE, offset);
+        } else if (pread(pager->file_descriptor, frame->data, PAGE_SIZE, offset) == -1) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
-void leaf_node_split_and_insert(Cursor* cursor,u_int32_t key,Row* value){
-    /*
-        Create a new node and move half the cells over.
-        Insert the new value in one of the two nodes.
-        Update parent or create a new parent.
-    */
-   void* old_node = get_page(cursor->table->pager,cursor->page_num);
-   u_int32_t new_page_num =  get_unused_page_num(cursor->table->pager);
-   void* new_node = get_page(cursor->table->pager,new_page_num);
-   initialize_leaf_node(new_node);
-    /*
-        All existing keys plus new key should be divided
-        evenly between old (left) and new (right) nodes.
-        Starting from the right, move each key to correct position.
-    */
-    // is possible to visualized as blocks of array like memory
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-        void* destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-            destination_node = new_node;
-        } else {
-            destination_node = old_node;
-        }
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void* destination = leaf_node_cell(destination_node, index_within_node);
-        if (i == cursor->cell_num) {
-            serialize_row(value, destination);
-        } else if (i > cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
-        } else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+/*
+    Hint the kernel to start reading pages we are about to need.
+    Cached pages are skipped and adjacent ones become a single range.
+*/
+void pager_prefetch(Pager* pager, uint32_t* page_nums, uint32_t count){
+    qsort(page_nums, count, sizeof(uint32_t), compare_page_nums);
+    pthread_mutex_lock(&pager->mutex);
+    if (pager->mode == PAGER_MODE_BUFFERED && (pager->ring != NULL || pager->direct_io)) {
+        pager_read_ahead(pager, page_nums, count);
+        pthread_mutex_unlock(&pager->mutex);
+        return;
+    }
+    uint32_t file_pages = pager->file_length / PAGE_SIZE;
+    uint32_t start = 0, length = 0;
+    for (uint32_t i = 0; i <= count; i++) {
+        bool wanted = i < count && page_nums[i] < file_pages &&
+                      (pager->mode == PAGER_MODE_MMAP || pager_lookup(pager, page_nums[i]) == INVALID_FRAME);
+        if (wanted && length > 0 && page_nums[i] == start + length) {
+            length++;
+            continue;
+        }
+        if (length > 0) {
+            off_t offset = (off_t)start * PAGE_SIZE;
+            if (pager->mode == PAGER_MODE_MMAP)
+                madvise(pager->map + offset, (size_t)length * PAGE_SIZE, MADV_WILLNEED);
+            else
+                posix_fadvise(pager->file_descriptor, offset, (off_t)length * PAGE_SIZE, POSIX_FADV_WILLNEED);
+            pager->stats.prefetches += length;
         }
+        start = wanted ? page_nums[i] : 0;
+        length = wanted ? 1 : 0;
     }
-    /* Update cell count on both leaf nodes */
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
-    if (is_node_root(old_node)) {
-        return create_new_root(cursor->table, new_page_num);
-    } else {
-        printf("Need to implement updating parent after split\n");
-        exit(EXIT_FAILURE);
+    pthread_mutex_unlock(&pager->mutex);
+}
+
+/*
+    Append every dirty frame to the log, the last one as the commit
+    frame. Returns the commit to pass pager_sync_commit, which waits
+    until it is on disk, or 0 when there is nothing to wait for.
+*/
+uint64_t pager_commit(Pager* pager){
+    pthread_mutex_lock(&pager->mutex);
+    // snapshots begun from here on see this transaction
+    pager->last_commit++;
+    if (pager->wal == NULL) {
+        pthread_mutex_unlock(&pager->mutex);
+        return 0;
+    }
+    uint32_t num_dirty = 0;
+    for (uint32_t i = 0; i < pager->frames_used; i++) {
+        if (pager->frames[i].in_use && pager->frames[i].dirty)
+            num_dirty++;
+    }
+    if (num_dirty == 0) {
+        if (pager->wal->num_frames == pager->wal->num_committed) {
+            pthread_mutex_unlock(&pager->mutex);
+            return 0;
+        }
+        // pages evicted during the transaction still need a commit frame
+        pager->frames[pager_fetch(pager, 0)].dirty = true;
+        num_dirty = 1;
+    }
+    for (uint32_t i = 0; i < pager->frames_used; i++) {
+        Frame* frame = &pager->frames[i];
+        if (!frame->in_use || !frame->dirty)
+            continue;
+        num_dirty--;
+        TRACE_PROBE2(page_flush, frame->page_num, 1);
+        wal_append(pager->wal, frame->page_num, frame->data,
+                   num_dirty == 0 ? pager->num_pages : 0);
+        pager_count_writes(pager, 1, sizeof(WalFrameHeader) + PAGE_SIZE);
+        frame->dirty = false;
     }
+    uint64_t commit = wal_commit_done(pager->wal);
+    if (pager->wal->num_frames >= WAL_AUTO_CHECKPOINT_FRAMES)
+        pager_checkpoint(pager);
+    pthread_mutex_unlock(&pager->mutex);
+    return commit;
 }
 
 /*
-    Until we start recycling free pages, new pages will always
-    go onto the end of the database file
+    Wait for a commit from pager_commit to reach the disk. Called
+    without the pager mutex, or any writer lock, so that commits made
+    meanwhile can share the same sync.
 */
-uint32_t get_unused_page_num(Pager* pager) { return pager->num_pages; }
\ No newline at end of file
+void pager_sync_commit(Pager* pager, uint64_t commit){
+    if (pager->wal != NULL && commit != 0)
+        wal_sync_commit(pager->wal, commit);
+}
+
+static int compare_frame_pages(const void* a, const void* b){
+    uint32_t left = (*(Frame* const*)a)->page_num;
+    uint32_t right = (*(Frame* const*)b)->page_num;
+    return (left > right) - (left < right);
+}
+
+static void pager_write_run(Pager* pager, Frame** run, uint32_t count){
+    TRACE_PROBE2(page_flush, run[0]->page_num, count);
+    struct iovec iov[PAGER_FLUSH_MAX_RUN];
+    for (uint32_t i = 0; i < count; i++) {
+        iov[i].iov_base = run[i]->data;
+        iov[i].iov_len = PAGE_SIZE;
+    }
+    off_t offset = (off_t)run[0]->page_num * PAGE_SIZE;
+    ssize_t bytes_written = pwritev(pager->file_descriptor, iov, count, offset);
+    if (bytes_written != (ssize_t)count * PAGE_SIZE) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager_count_writes(pager, count, PAGE_SIZE);
+    if (offset + (off_t)count * PAGE_SIZE > pager->file_length) {
+        pager->file_length = offset + (off_t)count * PAGE_SIZE;
+    }
+    for (uint32_t i = 0; i < count; i++)
+        run[i]->dirty = false;
+}
+
+// every dirty page queued on the ring, one submit per ring full
+static void pager_write_ring(Pager* pager, Frame** dirty, uint32_t num_dirty){
+    for (uint32_t i = 0; i < num_dirty; i++) {
+        TRACE_PROBE2(page_flush, dirty[i]->page_num, 1);
+        off_t offset = (off_t)dirty[i]->page_num * PAGE_SIZE;
+        if (!io_ring_write(pager->ring, pager->file_descriptor, dirty[i]->data, PAGE_SIZE, offset)) {
+            pager_ring_submit(pager);
+            io_ring_write(pager->ring, pager->file_descriptor, dirty[i]->data, PAGE_SIZE, offset);
+        }
+        if (offset + PAGE_SIZE > pager->file_length)
+            pager->file_length = offset + PAGE_SIZE;
+        dirty[i]->dirty = false;
+    }
+    pager_ring_submit(pager);
+    pager_count_writes(pager, num_dirty, PAGE_SIZE);
+}
+
+/*
+    Write every dirty frame to the file. Frames are sorted by page
+    number and runs of adjacent pages go out in a single pwritev, or
+    all of them through the ring.
+*/
+void pager_flush_dirty(Pager* pager){
+    pthread_mutex_lock(&pager->mutex);
+    Frame** dirty = malloc(pager->frames_used * sizeof(Frame*));
+    uint32_t num_dirty = 0;
+    for (uint32_t i = 0; i < pager->frames_used; i++) {
+        if (pager->frames[i].in_use && pager->frames[i].dirty)
+            dirty[num_dirty++] = &pager->frames[i];
+    }
+    qsort(dirty, num_dirty, sizeof(Frame*), compare_frame_pages);
+    if (pager->ring != NULL) {
+        pager_write_ring(pager, dirty, num_dirty);
+    } else {
+        uint32_t start = 0;
+        for (uint32_t i = 1; i <= num_dirty; i++) {
+            if (i == num_dirty || i - start == PAGER_FLUSH_MAX_RUN ||
+                dirty[i]->page_num != dirty[i - 1]->page_num + 1) {
+                pager_write_run(pager, &dirty[start], i - start);
+                start = i;
+            }
+        }
+    }
+    free(dirty);
+    pthread_mutex_unlock(&pager->mutex);
+}
+
+/*
+    Make everything written so far durable in the database file:
+    committed log frames are copied in, or dirty frames are flushed.
+*/
+void pager_checkpoint(Pager* pager){
+    if (pager->mode == PAGER_MODE_MMAP) {
+        if (msync(pager->map, pager->file_length, MS_SYNC) == -1) {
+            printf("Error syncing db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    if (pager->wal != NULL) {
+        pthread_mutex_lock(&pager->mutex);
+        // the latest image of each logged page is copied into the file
+        pager_count_writes(pager, pager->wal->index_size, PAGE_SIZE);
+        wal_checkpoint(pager->wal, pager->file_descriptor);
+        pager->file_length = lseek(pager->file_descriptor, 0, SEEK_END);
+        pthread_mutex_unlock(&pager->mutex);
+        return;
+    }
+    pager_flush_dirty(pager);
+    if (fsync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+    Shrink the database to its first num_pages pages, once nothing past
+    them is reachable any more. Everything written so far is made
+    durable first, so no image of a dropped page reaches the file later;
+    their frames are freed for reuse.
+*/
+void pager_truncate(Pager* pager, uint32_t num_pages){
+    pthread_mutex_lock(&pager->mutex);
+    pager_checkpoint(pager);
+    for (uint32_t i = 0; i < pager->frames_used; i++) {
+        Frame* frame = &pager->frames[i];
+        if (!frame->in_use || frame->page_num < num_pages)
+            continue;
+        if (frame->pin_count > 0) {
+            printf("Tried to truncate page %d which is pinned\n", frame->page_num);
+            exit(EXIT_FAILURE);
+        }
+        pager_hash_remove(pager, i);
+        lru_unlink(pager, i);
+        lru_push_back(pager, i);
+        frame->in_use = false;
+        frame->dirty = false;
+    }
+    if (ftruncate(pager->file_descriptor, (off_t)num_pages * PAGE_SIZE) == -1) {
+        printf("Error truncating db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->file_length = (off_t)num_pages * PAGE_SIZE;
+    pager->num_pages = num_pages;
+    pthread_mutex_unlock(&pager->mutex);
+}
+
+static void pager_release(Pager* pager){
+    if (pager->map != NULL)
+        munmap(pager->map, pager->map_reserve);
+    if (pager->wal != NULL)
+        wal_close(pager->wal);
+    if (pager->ring != NULL)
+        io_ring_close(pager->ring);
+    free(pager->wal_path);
+    version_store_close(pager->versions);
+    for (uint32_t i = 0; i < pager->num_frames; i++)
+        pthread_rwlock_destroy(&pager->frames[i].latch);
+    pthread_mutex_destroy(&pager->mutex);
+    free(pager->frame_data);
+    free(pager->frames);
+    free(pager->buckets);
+    free(pager);
+}
+
+void pager_close(Pager* pager){
+    pager_unpin_recent(pager);
+    if (pager->mode == PAGER_MODE_MMAP)
+        pager_unmap_file(pager);
+    if (pager->wal != NULL) {
+        pager_commit(pager);
+        pager_checkpoint(pager);
+        // everything is in the file now, a clean shutdown leaves no log
+        unlink(pager->wal_path);
+    }
+    // only dirty frames need to reach the file
+    if (pager->mode == PAGER_MODE_BUFFERED)
+        pager_flush_dirty(pager);
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+        printf("Error closing db file.\n");
+        exit(EXIT_FAILURE);
+    }
+    pager_release(pager);
+}
+
+static void plan_cache_release(PlanCache* cache)
+{
+    for (uint32_t i = 0; i < PLAN_CACHE_SIZE; i++)
+        free(cache->entries[i].text);
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+void db_close(Table* table){
+    pager_close(table->pager);
+    if (table->slow_log_file != NULL)
+        fclose(table->slow_log_file);
+    statement_arena_release();
+    pthread_mutex_destroy(&table->writer);
+    plan_cache_release(&table->plans);
+    free(table);
+}
+
+void free_table(Table *table)
+{
+    close(table->pager->file_descriptor);
+    pager_release(table->pager);
+    pthread_mutex_destroy(&table->writer);
+    plan_cache_release(&table->plans);
+    free(table);
+}
+
+uint32_t row_payload_size(Row* row)
+{
+    return PAYLOAD_HEADER_SIZE + strnlen(row->username, USERNAME_SIZE) +
+           strnlen(row->email, EMAIL_SIZE);
+}
+
+// write the payload of row, row_payload_size(row) bytes
+void serialize_row(Row *source, void *destination)
+{
+    uint16_t username_length = strnlen(source->username, USERNAME_SIZE);
+    uint16_t email_length = strnlen(source->email, EMAIL_SIZE);
+    memcpy(destination + PAYLOAD_USERNAME_LENGTH_OFFSET, &username_length, PAYLOAD_LENGTH_SIZE);
+    memcpy(destination + PAYLOAD_EMAIL_LENGTH_OFFSET, &email_length, PAYLOAD_LENGTH_SIZE);
+    memcpy(destination + PAYLOAD_HEADER_SIZE, source->username, username_length);
+    memcpy(destination + PAYLOAD_HEADER_SIZE + username_length, source->email, email_length);
+}
+
+void deserialize_row(uint64_t key, void *source, Row *destination)
+{
+    FieldSlice username = row_view_username(source);
+    FieldSlice email = row_view_email(source);
+    memset(destination, 0, sizeof(Row));
+    destination->id = key;
+    memcpy(destination->username, username.data, username.length);
+    memcpy(destination->email, email.data, email.length);
+}
+
+/*
+    Row views read fields in place from a whole payload, see
+    leaf_node_payload. Slices point into the page (or the payload
+    buffer) and are only valid while it stays put.
+*/
+FieldSlice row_view_username(const void* source)
+{
+    uint16_t length;
+    memcpy(&length, source + PAYLOAD_USERNAME_LENGTH_OFFSET, PAYLOAD_LENGTH_SIZE);
+    FieldSlice slice;
+    slice.data = source + PAYLOAD_HEADER_SIZE;
+    slice.length = length;
+    return slice;
+}
+
+FieldSlice row_view_email(const void* source)
+{
+    uint16_t username_length, length;
+    memcpy(&username_length, source + PAYLOAD_USERNAME_LENGTH_OFFSET, PAYLOAD_LENGTH_SIZE);
+    memcpy(&length, source + PAYLOAD_EMAIL_LENGTH_OFFSET, PAYLOAD_LENGTH_SIZE);
+    FieldSlice slice;
+    slice.data = source + PAYLOAD_HEADER_SIZE + username_length;
+    slice.length = length;
+    return slice;
+}
+
+// spilled payloads are built and gathered here, one buffer per thread
+static __thread uint8_t payload_buffer[2 * sizeof(uint16_t) + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE];
+
+/*
+    Write the cell for row and return its size. The part of the payload
+    past LEAF_NODE_MAX_LOCAL_PAYLOAD goes to a chain of overflow pages
+    allocated here, ended by a 0 next page. A page taken off the freelist
+    may still be read by a snapshot, so each is latched for write while
+    it is filled in, and only the page being linked stays latched.
+*/
+uint32_t leaf_node_build_cell(Table* table, Row* row, void* cell)
+{
+    Pager* pager = table->pager;
+    uint32_t payload_size = row_payload_size(row);
+    uint16_t stored_size = payload_size;
+    memcpy(cell + LEAF_NODE_PAYLOAD_SIZE_OFFSET, &stored_size, LEAF_NODE_PAYLOAD_SIZE_SIZE);
+    if (payload_size <= LEAF_NODE_MAX_LOCAL_PAYLOAD) {
+        serialize_row(row, cell + LEAF_NODE_VALUE_OFFSET);
+        return leaf_cell_size(payload_size);
+    }
+    void* payload = payload_buffer;
+    serialize_row(row, payload);
+    memcpy(cell + LEAF_NODE_VALUE_OFFSET, payload, LEAF_NODE_MAX_LOCAL_PAYLOAD);
+    uint32_t previous_page_num = INVALID_PAGE_NUM;
+    for (uint32_t written = LEAF_NODE_MAX_LOCAL_PAYLOAD; written < payload_size;) {
+        uint32_t page_num = get_unused_page_num(pager);
+        if (previous_page_num == INVALID_PAGE_NUM) {
+            memcpy(cell + LEAF_NODE_VALUE_OFFSET + LEAF_NODE_MAX_LOCAL_PAYLOAD,
+                   &page_num, LEAF_NODE_OVERFLOW_POINTER_SIZE);
+        } else {
+            *overflow_next_page(get_page(pager, previous_page_num)) = page_num;
+            pager_mark_dirty(pager, previous_page_num);
+            table_release_write_latch(table, previous_page_num);
+        }
+        void* page = table_latch_for_write(table, page_num);
+        pager_mark_dirty(pager, page_num);
+        set_node_type(page, NODE_OVERFLOW);
+        set_node_root(page, false);
+        *node_parent(page) = 0;
+        *overflow_next_page(page) = 0;
+        uint32_t chunk = payload_size - written;
+        if (chunk > OVERFLOW_SPACE_FOR_DATA)
+            chunk = OVERFLOW_SPACE_FOR_DATA;
+        memcpy(overflow_data(page), payload + written, chunk);
+        written += chunk;
+        previous_page_num = page_num;
+    }
+    table_release_write_latch(table, previous_page_num);
+    return leaf_cell_size(payload_size);
+}
+
+/*
+    The whole payload of a cell. One that fits the cell is returned in
+    place, a spilled one is gathered into the thread's payload buffer,
+    which the next spilled payload overwrites. Overflow pages are never
+    changed while linked, a shared latch is only held while copying.
+    With a snapshot they are read as of it instead: after a delete or
+    an update they are freed and may be reused.
+*/
+static void* leaf_node_read_payload(Pager* pager, void* node, uint32_t cell_num,
+                                    const uint64_t* snapshot)
+{
+    // sizes come from the file, checked before anything is copied by them
+    uint32_t payload_size = *leaf_node_payload_size(node, cell_num);
+    void* value = leaf_node_value(node, cell_num);
+    uint16_t username_length, email_length;
+    memcpy(&username_length, value + PAYLOAD_USERNAME_LENGTH_OFFSET, PAYLOAD_LENGTH_SIZE);
+    memcpy(&email_length, value + PAYLOAD_EMAIL_LENGTH_OFFSET, PAYLOAD_LENGTH_SIZE);
+    if (payload_size > MAX_PAYLOAD_SIZE || username_length > USERNAME_SIZE ||
+        email_length > EMAIL_SIZE ||
+        PAYLOAD_HEADER_SIZE + username_length + email_length != payload_size) {
+        printf("Cell %d has a payload of %d bytes. Corrupt file.\n", cell_num, payload_size);
+        exit(EXIT_FAILURE);
+    }
+    if (payload_size <= LEAF_NODE_MAX_LOCAL_PAYLOAD)
+        return value;
+    void* payload = payload_buffer;
+    memcpy(payload, value, LEAF_NODE_MAX_LOCAL_PAYLOAD);
+    uint8_t page_copy[PAGE_SIZE];
+    uint32_t page_num;
+    memcpy(&page_num, leaf_node_overflow_page(node, cell_num), LEAF_NODE_OVERFLOW_POINTER_SIZE);
+    for (uint32_t copied = LEAF_NODE_MAX_LOCAL_PAYLOAD; copied < payload_size;) {
+        void* page = page_copy;
+        if (snapshot != NULL)
+            pager_read_snapshot(pager, *snapshot, page_num, page);
+        else
+            page = pager_latch(pager, page_num, LATCH_SHARED);
+        if (get_node_type(page) != NODE_OVERFLOW) {
+            printf("Page %d in an overflow chain is not an overflow page. Corrupt file.\n", page_num);
+            exit(EXIT_FAILURE);
+        }
+        uint32_t chunk = payload_size - copied;
+        if (chunk > OVERFLOW_SPACE_FOR_DATA)
+            chunk = OVERFLOW_SPACE_FOR_DATA;
+        memcpy(payload + copied, overflow_data(page), chunk);
+        copied += chunk;
+        uint32_t next_page_num = *overflow_next_page(page);
+        if (snapshot == NULL)
+            pager_unlatch(pager, page_num);
+        page_num = next_page_num;
+    }
+    return payload;
+}
+
+void* leaf_node_payload(Pager* pager, void* node, uint32_t cell_num)
+{
+    return leaf_node_read_payload(pager, node, cell_num, NULL);
+}
+
+/*
+    Put the overflow chain of a spilled cell on the freelist. Snapshot
+    readers may be copying the pages, so each one is latched for write,
+    which keeps its image for them, before it is changed.
+*/
+static void leaf_node_free_overflow(Table* table, void* node, uint32_t cell_num)
+{
+    if (*leaf_node_payload_size(node, cell_num) <= LEAF_NODE_MAX_LOCAL_PAYLOAD)
+        return;
+    uint32_t page_num;
+    memcpy(&page_num, leaf_node_overflow_page(node, cell_num), LEAF_NODE_OVERFLOW_POINTER_SIZE);
+    while (page_num != 0) {
+        uint32_t next_page_num = *overflow_next_page(table_latch_for_write(table, page_num));
+        free_page_num(table->pager, page_num);
+        table_release_write_latch(table, page_num);
+        page_num = next_page_num;
+    }
+}
+
+// print the selected columns of a row, the id comes from the cell key
+void print_row_view(uint64_t key, const void* source, const SelectPredicate* select)
+{
+    putchar('(');
+    for (uint32_t i = 0; i < select->num_columns; i++) {
+        if (i > 0)
+            fputs(", ", stdout);
+        FieldSlice slice;
+        switch (select->columns[i]) {
+        case COLUMN_ID:
+            printf("%" PRIu64, key);
+            continue;
+        case COLUMN_USERNAME:
+            slice = row_view_username(source);
+            break;
+        case COLUMN_EMAIL:
+            slice = row_view_email(source);
+            break;
+        }
+        fwrite(slice.data, 1, slice.length, stdout);
+    }
+    fputs(")\n", stdout);
+}
+
+
+
+void* cursor_value(Cursor* cursor){
+    uint32_t page_num = cursor->page_num;
+    void* page = get_page(cursor->table->pager, page_num);
+    return leaf_node_payload(cursor->table->pager, page, cursor->cell_num);
+}
+
+void advance_cursor(Cursor* cursor){
+    uint32_t page_num = cursor->page_num;
+    void* node = get_page(cursor->table->pager, page_num);
+    cursor->cell_num += 1;
+    if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
+        /* Advance to next leaf node */
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            /* This was rightmost leaf */
+            cursor->end_of_table = true;
+        } else {
+            cursor->page_num = next_page_num;
+            cursor->cell_num = 0;
+        }
+    }
+}
+
+static uint32_t leaf_child_index(void* parent, uint32_t page_num, void* leaf){
+    uint32_t num_cells = *leaf_node_num_cells(leaf);
+    if (num_cells > 0) {
+        return internal_node_find_child(parent, *leaf_node_key(leaf, 0));
+    }
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    for (uint32_t i = 0; i < num_keys; i++) {
+        if (*internal_node_cell(parent, i) == page_num)
+            return i;
+    }
+    return num_keys;
+}
+
+/*
+    Read-ahead is only a hint, so a parent that the writer holds is
+    skipped rather than waited for: waiting on a parent while holding a
+    leaf would invert the writer's top down latch order.
+*/
+static void scan_prefetch(Cursor* cursor){
+    if (cursor->parent_page_num == INVALID_PAGE_NUM)
+        return;
+    Pager* pager = cursor->table->pager;
+    void* parent = pager_try_latch(pager, cursor->parent_page_num, LATCH_SHARED);
+    if (parent == NULL)
+        return;
+    uint32_t last_index = *internal_node_num_keys(parent);
+    if (last_index > cursor->child_index + SCAN_PREFETCH_LEAVES)
+        last_index = cursor->child_index + SCAN_PREFETCH_LEAVES;
+    // a split since the last batch can leave prefetched_index behind
+    if (cursor->prefetched_index < cursor->child_index)
+        cursor->prefetched_index = cursor->child_index;
+    // issue read-ahead in batches rather than one leaf at a time
+    uint32_t page_nums[SCAN_PREFETCH_LEAVES];
+    uint32_t count = 0;
+    if (get_node_type(parent) == NODE_INTERNAL && cursor->prefetched_index < last_index &&
+        cursor->prefetched_index <= cursor->child_index + SCAN_PREFETCH_LEAVES / 2) {
+        for (uint32_t i = cursor->prefetched_index + 1; i <= last_index; i++)
+            page_nums[count++] = *internal_node_child(parent, i);
+        cursor->prefetched_index = last_index;
+    }
+    pager_unlatch(pager, cursor->parent_page_num);
+    if (count > 0)
+        pager_prefetch(pager, page_nums, count);
+}
+
+// make the snapshot copy node of the leaf at page_num the cursor's leaf
+static void scan_enter_leaf(Cursor* cursor, uint32_t page_num, void* node){
+    Pager* pager = cursor->table->pager;
+    cursor->page_num = page_num;
+    cursor->node = node;
+    cursor->num_cells = *leaf_node_num_cells(node);
+    if (is_node_root(node)) {
+        cursor->parent_page_num = INVALID_PAGE_NUM;
+        return;
+    }
+    uint32_t parent_page_num = get_node_parent(node);
+    if (parent_page_num == cursor->parent_page_num) {
+        cursor->child_index++;
+    } else {
+        // crossed into the next parent, find where this leaf sits in it
+        cursor->parent_page_num = INVALID_PAGE_NUM;
+        void* parent = pager_try_latch(pager, parent_page_num, LATCH_SHARED);
+        if (parent == NULL)
+            return;
+        if (get_node_type(parent) == NODE_INTERNAL) {
+            cursor->parent_page_num = parent_page_num;
+            cursor->child_index = leaf_child_index(parent, page_num, node);
+            cursor->prefetched_index = cursor->child_index;
+        }
+        pager_unlatch(pager, parent_page_num);
+    }
+    scan_prefetch(cursor);
+}
+
+static void scan_skip_exhausted_leaves(Cursor* cursor){
+    while (cursor->cell_num >= cursor->num_cells) {
+        uint32_t next_page_num = *leaf_node_next_leaf(cursor->node);
+        if (next_page_num == 0) {
+            cursor->end_of_table = true;
+            return;
+        }
+        pager_read_snapshot(cursor->table->pager, cursor->snapshot, next_page_num, cursor->node);
+        scan_enter_leaf(cursor, next_page_num, cursor->node);
+        cursor->cell_num = 0;
+    }
+}
+
+/*
+    Reader descent to the leaf for key. Each node stays latched shared
+    until its child is, so the writer cannot split a node between a
+    reader choosing it and reaching it (latch crabbing). The cursor
+    holds its leaf latched in node until the caller unlatches it.
+*/
+Cursor* table_seek(Table* table, uint64_t key){
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    void* node = pager_latch(pager, page_num, LATCH_SHARED);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child(node, internal_node_find_child(node, key));
+        void* child = pager_latch(pager, child_page_num, LATCH_SHARED);
+        pager_unlatch(pager, page_num);
+        page_num = child_page_num;
+        node = child;
+    }
+    Cursor* cursor = cursor_alloc();
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->node = node;
+    cursor->num_cells = *leaf_node_num_cells(node);
+    cursor->cell_num = key_lower_bound64(leaf_node_keys(node), cursor->num_cells, key);
+    cursor->end_of_table = false;
+    cursor->parent_page_num = INVALID_PAGE_NUM;
+    return cursor;
+}
+
+/*
+    Copy the row with id into row, false when there is none. For C API
+    callers: the cursor goes back to the arena before returning.
+*/
+bool table_get(Table* table, uint64_t id, Row* row){
+    ArenaMark mark = arena_mark(&statement_arena);
+    Cursor* cursor = table_seek(table, id);
+    bool found = cursor->cell_num < cursor->num_cells &&
+                 *leaf_node_key(cursor->node, cursor->cell_num) == id;
+    if (found)
+        deserialize_row(id, leaf_node_payload(table->pager, cursor->node, cursor->cell_num), row);
+    pager_unlatch(table->pager, cursor->page_num);
+    pager_unpin_recent(table->pager);
+    arena_rewind(&statement_arena, mark);
+    return found;
+}
+
+// levels from the root down to the leaves, along the leftmost path
+static uint32_t table_height(Table* table){
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    void* node = pager_latch(pager, page_num, LATCH_SHARED);
+    uint32_t height = 1;
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child(node, 0);
+        void* child = pager_latch(pager, child_page_num, LATCH_SHARED);
+        pager_unlatch(pager, page_num);
+        page_num = child_page_num;
+        node = child;
+        height++;
+    }
+    pager_unlatch(pager, page_num);
+    return height;
+}
+
+/*
+    Copy every counter of table into stats. Safe to call from any
+    thread while statements run, e.g. by a monitoring agent polling it;
+    the copy is not of one instant, each counter in it is exact.
+*/
+void table_stats(Table* table, EngineStats* stats){
+    Pager* pager = table->pager;
+    pthread_mutex_lock(&pager->mutex);
+    stats->pager = pager->stats;
+    stats->num_pages = pager->num_pages;
+    pthread_mutex_unlock(&pager->mutex);
+    // the wal counts syncs under its own lock, not the pager's
+    stats->wal_syncs = pager->wal != NULL ? wal_syncs(pager->wal) : 0;
+    pthread_mutex_lock(&table->plans.mutex);
+    stats->plan_cache_hits = table->plans.hits;
+    stats->plan_cache_misses = table->plans.misses;
+    pthread_mutex_unlock(&table->plans.mutex);
+    TableStats* from = &table->stats;
+    stats->table.leaf_splits = stats_load(&from->leaf_splits);
+    stats->table.internal_splits = stats_load(&from->internal_splits);
+    stats->table.merges = stats_load(&from->merges);
+    for (uint32_t i = 0; i < NUM_STATEMENT_TYPES; i++) {
+        histogram_copy(&stats->table.statements[i].latency, &from->statements[i].latency);
+        stats->table.statements[i].rows = stats_load(&from->statements[i].rows);
+    }
+    stats->tree_height = table_height(table);
+}
+
+static const char* statement_type_names[NUM_STATEMENT_TYPES] = {
+    "insert", "select", "delete", "update", "begin", "commit"};
+
+// one "name: value" per line, latencies in nanoseconds
+void print_stats(const EngineStats* stats){
+    printf("pages: %" PRIu32 "\n", stats->num_pages);
+    printf("tree_height: %" PRIu32 "\n", stats->tree_height);
+    printf("cache_hits: %" PRIu64 "\n", stats->pager.hits);
+    printf("cache_misses: %" PRIu64 "\n", stats->pager.misses);
+    printf("cache_evictions: %" PRIu64 "\n", stats->pager.evictions);
+    printf("cache_prefetches: %" PRIu64 "\n", stats->pager.prefetches);
+    printf("pages_read: %" PRIu64 "\n", stats->pager.pages_read);
+    printf("pages_written: %" PRIu64 "\n", stats->pager.pages_written);
+    printf("bytes_flushed: %" PRIu64 "\n", stats->pager.bytes_flushed);
+    printf("wal_syncs: %" PRIu64 "\n", stats->wal_syncs);
+    printf("leaf_splits: %" PRIu64 "\n", stats->table.leaf_splits);
+    printf("internal_splits: %" PRIu64 "\n", stats->table.internal_splits);
+    printf("merges: %" PRIu64 "\n", stats->table.merges);
+    printf("plan_cache_hits: %" PRIu64 "\n", stats->plan_cache_hits);
+    printf("plan_cache_misses: %" PRIu64 "\n", stats->plan_cache_misses);
+    for (uint32_t i = 0; i < NUM_STATEMENT_TYPES; i++) {
+        const StatementStats* statement = &stats->table.statements[i];
+        const Histogram* latency = &statement->latency;
+        printf("%s: count %" PRIu64 " rows %" PRIu64 " p50 %" PRIu64 " p99 %" PRIu64
+               " p999 %" PRIu64 " max %" PRIu64 "\n",
+               statement_type_names[i], latency->total, statement->rows,
+               histogram_percentile(latency, 50), histogram_percentile(latency, 99),
+               histogram_percentile(latency, 99.9), latency->max);
+    }
+}
+
+/*
+    A cursor for full and range scans, positioned at the first row
+    with id >= key. It reads every page as of the commit it began at,
+    one private leaf copy at a time, so it holds no latch between rows
+    and inserts go on while it is open. It reads ahead the leaves that
+    follow the current one.
+*/
+Cursor* scan_start(Table* table, uint64_t key){
+    Pager* pager = table->pager;
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    // a snapshot begins between write statements, never inside one
+    pthread_mutex_lock(&table->writer);
+    cursor->snapshot = pager_begin_snapshot(pager);
+    pthread_mutex_unlock(&table->writer);
+    void* node = malloc(PAGE_SIZE);
+    uint32_t page_num = table->root_page_num;
+    pager_read_snapshot(pager, cursor->snapshot, page_num, node);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = *internal_node_child(node, internal_node_find_child(node, key));
+        pager_read_snapshot(pager, cursor->snapshot, page_num, node);
+    }
+    cursor->end_of_table = false;
+    cursor->parent_page_num = INVALID_PAGE_NUM;
+    scan_enter_leaf(cursor, page_num, node);
+    // the key may be past the end of its leaf, then start on the next one
+    cursor->cell_num = key_lower_bound64(leaf_node_keys(node), cursor->num_cells, key);
+    scan_skip_exhausted_leaves(cursor);
+    return cursor;
+}
+
+void* scan_value(Cursor* cursor){
+    return leaf_node_read_payload(cursor->table->pager, cursor->node, cursor->cell_num,
+                                  &cursor->snapshot);
+}
+
+void scan_advance(Cursor* cursor){
+    cursor->cell_num += 1;
+    scan_skip_exhausted_leaves(cursor);
+}
+
+uint64_t scan_key(Cursor* cursor){
+    return *leaf_node_key(cursor->node, cursor->cell_num);
+}
+
+void scan_close(Cursor* cursor){
+    pager_end_snapshot(cursor->table->pager, cursor->snapshot);
+    free(cursor->node);
+    free(cursor);
+}
+
+MetaCommandResult do_meta_command(InputBuffer *input_buffer,Table* table)
+{
+    if (strcmp(input_buffer->buffer, TERMINATE_CMD) == 0)
+    {
+        close_input_buffer(input_buffer);
+        db_close(table);
+        exit(EXIT_SUCCESS);
+    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+        printf("Tree:\n");
+        print_tree(table->pager, table->root_page_num, 0);
+        return META_COMMAND_SUCCESS;
+    }else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+       printf("Constants:\n");
+       print_constants();
+       return META_COMMAND_SUCCESS;
+   } else if (strcmp(input_buffer->buffer, ".checkpoint") == 0) {
+       pthread_mutex_lock(&table->writer);
+       // it would commit the open transaction halfway
+       if (table->in_transaction) {
+           printf("Cannot checkpoint inside a transaction.\n");
+           pthread_mutex_unlock(&table->writer);
+           return META_COMMAND_SUCCESS;
+       }
+       pager_commit(table->pager);
+       pager_checkpoint(table->pager);
+       pthread_mutex_unlock(&table->writer);
+       return META_COMMAND_SUCCESS;
+   } else if (strncmp(input_buffer->buffer, ".import ", 8) == 0) {
+       char filename[256];
+       double fill_factor = BULK_LOAD_DEFAULT_FILL_FACTOR;
+       if (sscanf(input_buffer->buffer, ".import %255s %lf", filename, &fill_factor) < 1) {
+           printf("Usage: .import <file> [fill factor]\n");
+           return META_COMMAND_SUCCESS;
+       }
+       import_rows(table, filename, fill_factor);
+       return META_COMMAND_SUCCESS;
+   } else if (strcmp(input_buffer->buffer, ".vacuum") == 0) {
+       table_vacuum(table);
+       return META_COMMAND_SUCCESS;
+   } else if (strncmp(input_buffer->buffer, ".slowlog ", 9) == 0) {
+       char argument[256];
+       char path[256];
+       int parsed = sscanf(input_buffer->buffer, ".slowlog %255s %255s", argument, path);
+       char* end = NULL;
+       uint64_t threshold_usec = parsed >= 1 ? strtoull(argument, &end, 10) : 0;
+       bool off = parsed == 1 && strcmp(argument, "off") == 0;
+       if (!off && (parsed < 1 || *end != '\0')) {
+           printf("Usage: .slowlog <microseconds> [file] | .slowlog off\n");
+           return META_COMMAND_SUCCESS;
+       }
+       FILE* log = stderr;
+       if (parsed == 2 && (log = fopen(path, "a")) == NULL) {
+           printf("Unable to open slow log %s\n", path);
+           return META_COMMAND_SUCCESS;
+       }
+       table_set_slow_log(table, threshold_usec, off ? NULL : log);
+       if (table->slow_log_file != NULL)
+           fclose(table->slow_log_file);
+       table->slow_log_file = log != stderr ? log : NULL;
+       return META_COMMAND_SUCCESS;
+   } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+       EngineStats* stats = malloc(sizeof(EngineStats));
+       table_stats(table, stats);
+       printf("Stats:\n");
+       print_stats(stats);
+       free(stats);
+       return META_COMMAND_SUCCESS;
+   }
+    return META_COMMAND_UNRECOGNIZED_COMMAND;
+}
+
+static const char* skip_spaces(const char* text)
+{
+    while (*text == ' ')
+        text++;
+    return text;
+}
+
+static bool match_keyword(const char* text, const char* keyword)
+{
+    size_t length = strlen(keyword);
+    return strncmp(text, keyword, length) == 0 &&
+           (text[length] == '\0' || text[length] == ' ' || text[length] == ',');
+}
+
+// consume token and the spaces after it, a word has to end where token does
+static bool expect_token(const char** text, const char* token)
+{
+    size_t length = strlen(token);
+    if (strncmp(*text, token, length) != 0)
+        return false;
+    if (isalnum((unsigned char)token[length - 1]) && isalnum((unsigned char)(*text)[length]))
+        return false;
+    *text = skip_spaces(*text + length);
+    return true;
+}
+
+static bool add_param(PreparedStatement* plan, ParamSlot slot)
+{
+    if (plan->num_params == MAX_STATEMENT_PARAMS)
+        return false;
+    plan->params[plan->num_params++] = slot;
+    return true;
+}
+
+// a number, or a ? for one bound later to slot
+static PrepareResult parse_number(const char** text, uint64_t* value, PreparedStatement* plan,
+                                  ParamSlot slot)
+{
+    const char* start = *text;
+    char* end = (char*)start + 1;
+    if (*start == '?')
+    {
+        if (!add_param(plan, slot))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    else
+    {
+        if (*start < '0' || *start > '9')
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        errno = 0;
+        *value = strtoull(start, &end, 10);
+        if (errno == ERANGE)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (*end != '\0' && *end != ' ' && *end != ',')
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *text = skip_spaces(end);
+    return PREPARE_SUCCESS;
+}
+
+/*
+    A string value: one word ending at any of separators, or a ? for
+    one bound later to slot. A word too long for its column is refused
+    rather than cut.
+*/
+static PrepareResult parse_word(const char** text, const char* separators, char* field,
+                                size_t field_size, PreparedStatement* plan, ParamSlot slot)
+{
+    size_t length = strcspn(*text, separators);
+    if (length == 0)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (length == 1 && **text == '?')
+    {
+        if (!add_param(plan, slot))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    else
+    {
+        if (length > field_size)
+        {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        memset(field, 0, field_size);
+        memcpy(field, *text, length);
+    }
+    *text = skip_spaces(*text + length);
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_insert(const char* clause, PreparedStatement* plan)
+{
+    Row* row = &plan->statement.row_to_insert;
+    if (*clause == '-')
+    {
+        return PREPARE_NEGATIVE_ID;
+    }
+    PrepareResult result = parse_number(&clause, &row->id, plan, PARAM_ROW_ID);
+    if (result == PREPARE_SUCCESS)
+        result = parse_word(&clause, " ", row->username, COLUMN_USERNAME_SIZE, plan, PARAM_USERNAME);
+    if (result == PREPARE_SUCCESS)
+        result = parse_word(&clause, " ", row->email, COLUMN_EMAIL_SIZE, plan, PARAM_EMAIL);
+    if (result == PREPARE_SUCCESS && *clause != '\0')
+        result = PREPARE_SYNTAX_ERROR;
+    return result;
+}
+
+/*
+    "insert values (id, username, email), ..." into statement->rows,
+    which grows as rows are parsed. A ? binds single row inserts only.
+*/
+static PrepareResult parse_insert_values(const char* clause, PreparedStatement* plan)
+{
+    Statement* statement = &plan->statement;
+    uint32_t capacity = 0;
+    PrepareResult result = PREPARE_SUCCESS;
+    do
+    {
+        if (!expect_token(&clause, "("))
+        {
+            result = PREPARE_SYNTAX_ERROR;
+            break;
+        }
+        if (statement->num_rows == capacity)
+        {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            statement->rows = realloc(statement->rows, capacity * sizeof(Row));
+        }
+        Row* row = &statement->rows[statement->num_rows++];
+        memset(row, 0, sizeof(Row));
+        result = *clause == '-' ? PREPARE_NEGATIVE_ID
+                                : parse_number(&clause, &row->id, plan, PARAM_ROW_ID);
+        if (result == PREPARE_SUCCESS && !expect_token(&clause, ","))
+            result = PREPARE_SYNTAX_ERROR;
+        if (result == PREPARE_SUCCESS)
+            result = parse_word(&clause, " ,)", row->username, COLUMN_USERNAME_SIZE, plan,
+                                PARAM_USERNAME);
+        if (result == PREPARE_SUCCESS && !expect_token(&clause, ","))
+            result = PREPARE_SYNTAX_ERROR;
+        if (result == PREPARE_SUCCESS)
+            result = parse_word(&clause, " ,)", row->email, COLUMN_EMAIL_SIZE, plan, PARAM_EMAIL);
+        if (result == PREPARE_SUCCESS && (!expect_token(&clause, ")") || plan->num_params > 0))
+            result = PREPARE_SYNTAX_ERROR;
+    } while (result == PREPARE_SUCCESS && expect_token(&clause, ","));
+    if (result == PREPARE_SUCCESS && *clause != '\0')
+        result = PREPARE_SYNTAX_ERROR;
+    if (result != PREPARE_SUCCESS)
+        statement_release(statement);
+    return result;
+}
+
+// free the rows of an insert values statement
+void statement_release(Statement* statement)
+{
+    free(statement->rows);
+    statement->rows = NULL;
+    statement->num_rows = 0;
+}
+
+/*
+    Parse the projection list. No list or "*" selects every column,
+    otherwise columns are printed in the order they are listed.
+*/
+static PrepareResult prepare_select_columns(const char** clause, SelectPredicate* select)
+{
+    static const char* names[] = {"id", "username", "email"};
+    const char* text = *clause;
+    select->num_columns = 0;
+    if (*text == '\0' || match_keyword(text, "where") || match_keyword(text, "limit") ||
+        match_keyword(text, "*"))
+    {
+        if (*text == '*')
+            text = skip_spaces(text + 1);
+        for (uint32_t i = 0; i < MAX_SELECT_COLUMNS; i++)
+            select->columns[select->num_columns++] = (Column)i;
+        *clause = text;
+        return PREPARE_SUCCESS;
+    }
+    while (true)
+    {
+        uint32_t column = 0;
+        while (column < MAX_SELECT_COLUMNS && !match_keyword(text, names[column]))
+            column++;
+        if (column == MAX_SELECT_COLUMNS || select->num_columns == MAX_SELECT_COLUMNS)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        select->columns[select->num_columns++] = (Column)column;
+        text = skip_spaces(text + strlen(names[column]));
+        if (*text != ',')
+            break;
+        text = skip_spaces(text + 1);
+    }
+    *clause = text;
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_select(const char* clause, PreparedStatement* plan)
+{
+    SelectPredicate* select = &plan->statement.select;
+    select->start_id = 0;
+    select->end_id = UINT64_MAX;
+    select->limit = UINT32_MAX;
+    PrepareResult result = prepare_select_columns(&clause, select);
+    if (result == PREPARE_SUCCESS && expect_token(&clause, "where"))
+    {
+        if (!expect_token(&clause, "id"))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (expect_token(&clause, "="))
+        {
+            result = parse_number(&clause, &select->start_id, plan, PARAM_SELECT_ID);
+            select->end_id = select->start_id;
+        }
+        else if (expect_token(&clause, "between"))
+        {
+            result = parse_number(&clause, &select->start_id, plan, PARAM_SELECT_START);
+            if (result == PREPARE_SUCCESS && !expect_token(&clause, "and"))
+                result = PREPARE_SYNTAX_ERROR;
+            if (result == PREPARE_SUCCESS)
+                result = parse_number(&clause, &select->end_id, plan, PARAM_SELECT_END);
+        }
+        else
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (result == PREPARE_SUCCESS && expect_token(&clause, "limit"))
+    {
+        uint64_t limit = select->limit;
+        result = parse_number(&clause, &limit, plan, PARAM_SELECT_LIMIT);
+        if (limit > UINT32_MAX)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        select->limit = limit;
+    }
+    if (result == PREPARE_SUCCESS && *clause != '\0')
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return result;
+}
+
+static PrepareResult parse_where_id(const char* clause, PreparedStatement* plan)
+{
+    if (!expect_token(&clause, "where") || !expect_token(&clause, "id") ||
+        !expect_token(&clause, "="))
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    PrepareResult result = parse_number(&clause, &plan->statement.target.id, plan, PARAM_TARGET_ID);
+    if (result == PREPARE_SUCCESS && *clause != '\0')
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return result;
+}
+
+/*
+    Parse the assignments of an update into row_to_insert. The id is
+    the key and cannot be set.
+*/
+static PrepareResult parse_update(const char* clause, PreparedStatement* plan)
+{
+    RowTarget* target = &plan->statement.target;
+    Row* row = &plan->statement.row_to_insert;
+    if (!expect_token(&clause, "set"))
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    while (true)
+    {
+        PrepareResult result;
+        Column column;
+        if (expect_token(&clause, "username") && expect_token(&clause, "="))
+        {
+            column = COLUMN_USERNAME;
+            result = parse_word(&clause, " ,", row->username, COLUMN_USERNAME_SIZE, plan,
+                                PARAM_USERNAME);
+        }
+        else if (expect_token(&clause, "email") && expect_token(&clause, "="))
+        {
+            column = COLUMN_EMAIL;
+            result = parse_word(&clause, " ,", row->email, COLUMN_EMAIL_SIZE, plan, PARAM_EMAIL);
+        }
+        else
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (result != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+        if (target->num_columns == MAX_SELECT_COLUMNS)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        target->columns[target->num_columns++] = column;
+        if (!expect_token(&clause, ","))
+            break;
+    }
+    return parse_where_id(clause, plan);
+}
+
+/*
+    Compile the text of a statement. Where a value goes, a ? stands for
+    one that is bound after compiling, see prepared_bind_int and
+    prepared_bind_text.
+*/
+PrepareResult statement_compile(const char* text, PreparedStatement* plan)
+{
+    memset(plan, 0, sizeof(PreparedStatement));
+    Statement* statement = &plan->statement;
+    text = skip_spaces(text);
+    if (expect_token(&text, "insert"))
+    {
+        statement->type = STATEMENT_INSERT;
+        if (expect_token(&text, "values"))
+            return parse_insert_values(text, plan);
+        return parse_insert(text, plan);
+    }
+    if (expect_token(&text, "select"))
+    {
+        statement->type = STATEMENT_SELECT;
+        return parse_select(text, plan);
+    }
+    if (expect_token(&text, "delete"))
+    {
+        statement->type = STATEMENT_DELETE;
+        return parse_where_id(text, plan);
+    }
+    if (expect_token(&text, "update"))
+    {
+        statement->type = STATEMENT_UPDATE;
+        return parse_update(text, plan);
+    }
+    if (expect_token(&text, "begin"))
+    {
+        statement->type = STATEMENT_BEGIN;
+        return *text == '\0' ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+    }
+    if (expect_token(&text, "commit"))
+    {
+        statement->type = STATEMENT_COMMIT;
+        return *text == '\0' ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+
+PrepareResult prepare_statement(InputBuffer *input_buffer, Statement *statement)
+{
+    TRACE_PROBE1(prepare_start, input_buffer->buffer);
+    uint64_t start = stats_now_nsec();
+    PreparedStatement plan;
+    PrepareResult result = statement_compile(input_buffer->buffer, &plan);
+    // nothing binds a ? typed at the prompt
+    if (result == PREPARE_SUCCESS && plan.num_params > 0)
+    {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result == PREPARE_SUCCESS)
+    {
+        *statement = plan.statement;
+        size_t length = input_buffer->input_length < SLOW_LOG_MAX_TEXT - 1 ? input_buffer->input_length
+                                                                           : SLOW_LOG_MAX_TEXT - 1;
+        memcpy(statement_trace.text, input_buffer->buffer, length);
+        statement_trace.text[length] = '\0';
+        statement_trace.prepare_nsec = stats_now_nsec() - start;
+    }
+    TRACE_PROBE2(prepare_done, input_buffer->buffer, result);
+    return result;
+}
+
+static uint32_t plan_hash(const char* text)
+{
+    uint32_t hash = 2166136261u;
+    for (; *text != '\0'; text++)
+        hash = (hash ^ (uint8_t)*text) * 16777619u;
+    return hash;
+}
+
+/*
+    Compile text through the table's plan cache: a statement seen before
+    is copied from its entry instead of parsed again. Statements that
+    fail to compile are not cached, nor are insert values statements:
+    their text carries the rows, which the caller releases.
+*/
+PrepareResult table_prepare(Table* table, const char* text, PreparedStatement* prepared)
+{
+    PlanCache* cache = &table->plans;
+    uint32_t hash = plan_hash(text);
+    pthread_mutex_lock(&cache->mutex);
+    cache->clock++;
+    // unused entries have never been used, they go before any other
+    PlanCacheEntry* victim = &cache->entries[0];
+    for (uint32_t i = 0; i < PLAN_CACHE_SIZE; i++) {
+        PlanCacheEntry* entry = &cache->entries[i];
+        if (entry->text != NULL && entry->hash == hash && strcmp(entry->text, text) == 0) {
+            entry->last_used = cache->clock;
+            *prepared = entry->plan;
+            cache->hits++;
+            pthread_mutex_unlock(&cache->mutex);
+            return PREPARE_SUCCESS;
+        }
+        if (entry->last_used < victim->last_used)
+            victim = entry;
+    }
+    cache->misses++;
+    PrepareResult result = statement_compile(text, prepared);
+    if (result == PREPARE_SUCCESS && prepared->statement.rows == NULL) {
+        free(victim->text);
+        victim->text = strdup(text);
+        victim->hash = hash;
+        victim->last_used = cache->clock;
+        victim->plan = *prepared;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return result;
+}
+
+// bind the index-th ? (from 0) of a statement to a number
+PrepareResult prepared_bind_int(PreparedStatement* prepared, uint32_t index, uint64_t value)
+{
+    if (index >= prepared->num_params)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    Statement* statement = &prepared->statement;
+    switch (prepared->params[index])
+    {
+    case PARAM_ROW_ID:
+        statement->row_to_insert.id = value;
+        break;
+    case PARAM_SELECT_ID:
+        statement->select.start_id = value;
+        statement->select.end_id = value;
+        break;
+    case PARAM_SELECT_START:
+        statement->select.start_id = value;
+        break;
+    case PARAM_SELECT_END:
+        statement->select.end_id = value;
+        break;
+    case PARAM_SELECT_LIMIT:
+        if (value > UINT32_MAX)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->select.limit = value;
+        break;
+    case PARAM_TARGET_ID:
+        statement->target.id = value;
+        break;
+    default:
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// bind the index-th ? (from 0) of a statement to a string, which may hold spaces
+PrepareResult prepared_bind_text(PreparedStatement* prepared, uint32_t index, const char* value)
+{
+    if (index >= prepared->num_params)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    char* field;
+    size_t field_size;
+    switch (prepared->params[index])
+    {
+    case PARAM_USERNAME:
+        field = prepared->statement.row_to_insert.username;
+        field_size = COLUMN_USERNAME_SIZE;
+        break;
+    case PARAM_EMAIL:
+        field = prepared->statement.row_to_insert.email;
+        field_size = COLUMN_EMAIL_SIZE;
+        break;
+    default:
+        return PREPARE_SYNTAX_ERROR;
+    }
+    size_t length = strlen(value);
+    if (length > field_size)
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    memset(field, 0, field_size);
+    memcpy(field, value, length);
+    return PREPARE_SUCCESS;
+}
+
+ExecuteResult prepared_execute(PreparedStatement* prepared, Table* table)
+{
+    return execute_statement(&prepared->statement, table);
+}
+
+/*
+    The writer's latches. Every page a write statement changes is latched
+    exclusively first, including the pages its splits create, so readers
+    never see a node half way through a change. They are kept in the
+    table's write set until the statement releases them.
+*/
+void* table_latch_for_write(Table* table, uint32_t page_num){
+    for (uint32_t i = 0; i < table->num_write_latches; i++) {
+        if (table->write_latches[i] == page_num)
+            return get_page(table->pager, page_num);
+    }
+    if (table->num_write_latches == TABLE_MAX_WRITE_LATCHES) {
+        printf("Write statement latched more than %d pages\n", TABLE_MAX_WRITE_LATCHES);
+        exit(EXIT_FAILURE);
+    }
+    void* page = pager_latch(table->pager, page_num, LATCH_EXCLUSIVE);
+    table->write_latches[table->num_write_latches++] = page_num;
+    // open snapshots may still have to read the page as it is now
+    pager_save_version(table->pager, page_num, page);
+    return page;
+}
+
+// release all but the last keep latches of the write set
+void table_release_write_latches(Table* table, uint32_t keep){
+    uint32_t release = table->num_write_latches - keep;
+    for (uint32_t i = 0; i < release; i++)
+        pager_unlatch(table->pager, table->write_latches[i]);
+    memmove(table->write_latches, table->write_latches + release, keep * sizeof(uint32_t));
+    table->num_write_latches = keep;
+}
+
+/*
+    Release one page of the write set before the statement ends. Only
+    for overflow pages: readers reach them through a leaf that stays
+    latched, and snapshots find the version saved when they were latched.
+*/
+void table_release_write_latch(Table* table, uint32_t page_num){
+    for (uint32_t i = 0; i < table->num_write_latches; i++) {
+        if (table->write_latches[i] != page_num)
+            continue;
+        pager_unlatch(table->pager, page_num);
+        table->num_write_latches--;
+        memmove(table->write_latches + i, table->write_latches + i + 1,
+                (table->num_write_latches - i) * sizeof(uint32_t));
+        return;
+    }
+    printf("Tried to release page %d which is not latched for write\n", page_num);
+    exit(EXIT_FAILURE);
+}
+
+/*
+    Writer descent to the leaf for an insert of a cell_size byte cell at
+    key. Nodes are latched exclusively on the way down and as soon as one
+    cannot split, the latches above it are dropped (latch crabbing): only
+    the nodes a split can reach stay latched.
+*/
+static Cursor* table_find_for_write(Table* table, uint64_t key, uint32_t cell_size){
+    uint32_t page_num = table->root_page_num;
+    void* node = table_latch_for_write(table, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_index = internal_node_find_child(node, key);
+        if (internal_node_can_take_key(node, child_index))
+            table_release_write_latches(table, 1);
+        page_num = *internal_node_child(node, child_index);
+        node = table_latch_for_write(table, page_num);
+    }
+    if (leaf_node_free_space(node) >= cell_size + LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE)
+        table_release_write_latches(table, 1);
+    return leaf_node_find(table, page_num, key);
+}
+
+ExecuteResult execute_insert(Statement *statement, Table *table)
+{
+    if (statement->rows != NULL)
+    {
+        return table_insert_rows(table, statement->rows, statement->num_rows);
+    }
+    Row *row_to_insert = &(statement->row_to_insert);
+    uint64_t key_to_insert = row_to_insert->id;
+    uint32_t cell_size = leaf_cell_size(row_payload_size(row_to_insert));
+    Cursor* cursor = table_find_for_write(table, key_to_insert, cell_size);
+    void* node = get_page(table->pager, cursor->page_num);
+    uint32_t num_cells = (*leaf_node_num_cells(node));
+    ExecuteResult result = EXECUTE_SUCCESS;
+    if(cursor->cell_num < num_cells &&
+       *leaf_node_key(node, cursor->cell_num) == key_to_insert){
+        result = EXECUTE_DUPLICATE_KEY;
+    } else {
+        leaf_node_insert(cursor, key_to_insert, row_to_insert);
+    }
+    table_release_write_latches(table, 0);
+    return result;
+}
+
+/*
+    Writer descent to the leaf holding key for a delete. A node is safe
+    when it stays above its minimum after losing a key (an internal
+    node one of whose children may be merged away) or the cell (the
+    leaf), and the latches above a safe node are dropped.
+*/
+static Cursor* table_find_for_delete(Table* table, uint64_t key){
+    uint32_t page_num = table->root_page_num;
+    void* node = table_latch_for_write(table, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        // a root down to no keys is replaced by its child
+        if (is_node_root(node) ? num_keys > 1 : num_keys > INTERNAL_NODE_MIN_KEYS)
+            table_release_write_latches(table, 1);
+        page_num = *internal_node_child(node, internal_node_find_child(node, key));
+        node = table_latch_for_write(table, page_num);
+    }
+    Cursor* cursor = leaf_node_find(table, page_num, key);
+    uint32_t removed = 0;
+    if (cursor->cell_num < *leaf_node_num_cells(node)) {
+        removed = leaf_node_cell_size(node, cursor->cell_num) +
+                  LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE;
+    }
+    if (is_node_root(node) || leaf_node_used_space(node) - removed >= LEAF_NODE_MIN_USED)
+        table_release_write_latches(table, 1);
+    return cursor;
+}
+
+/*
+    Merge two leaves when their cells fit one, else even the cells out
+    by size and move the separator in parent. The separator cannot move
+    when the parent has no room to widen for it, the leaves are then
+    left as they are. Returns whether right was merged into left.
+*/
+static bool leaf_node_rebalance(void* parent, uint32_t left_index, void* left, void* right){
+    const uint32_t per_cell = LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE;
+    uint32_t total_bytes = leaf_node_used_space(left) + leaf_node_used_space(right);
+    if (total_bytes <= LEAF_NODE_SPACE_FOR_CELLS) {
+        uint32_t num_cells = *leaf_node_num_cells(right);
+        for (uint32_t i = 0; i < num_cells; i++) {
+            leaf_node_append_cell(left, *leaf_node_key(right, i), leaf_node_cell(right, i),
+                                  leaf_node_cell_size(right, i));
+        }
+        *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+        return true;
+    }
+    uint8_t old_cells[2][PAGE_SIZE];
+    memcpy(old_cells[0], left, PAGE_SIZE);
+    memcpy(old_cells[1], right, PAGE_SIZE);
+    uint32_t left_cells = *leaf_node_num_cells(old_cells[0]);
+    uint32_t num_cells = left_cells + *leaf_node_num_cells(old_cells[1]);
+    // the left leaf takes cells until it holds half the bytes
+    uint32_t split = 0;
+    for (uint32_t left_bytes = 0; left_bytes < total_bytes / 2; split++) {
+        void* source = split < left_cells ? old_cells[0] : old_cells[1];
+        uint32_t index = split < left_cells ? split : split - left_cells;
+        left_bytes += leaf_node_cell_size(source, index) + per_cell;
+    }
+    void* last = split - 1 < left_cells ? old_cells[0] : old_cells[1];
+    uint64_t left_max = *leaf_node_key(last, split - 1 < left_cells ? split - 1 : split - 1 - left_cells);
+    if (split == num_cells || !internal_node_can_set_key(parent, left_max))
+        return false;
+    *leaf_node_num_cells(left) = *leaf_node_num_cells(right) = 0;
+    *leaf_node_content_start(left) = *leaf_node_content_start(right) = PAGE_SIZE;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        void* source = i < left_cells ? old_cells[0] : old_cells[1];
+        uint32_t index = i < left_cells ? i : i - left_cells;
+        leaf_node_append_cell(i < split ? left : right, *leaf_node_key(source, index),
+                              leaf_node_cell(source, index), leaf_node_cell_size(source, index));
+    }
+    internal_node_replace_key(parent, left_index, left_max);
+    return false;
+}
+
+/*
+    The same for two internal nodes: their children and the keys between
+    them, with the parent's separator between the two, go into left when
+    they fit one node and are split evenly otherwise.
+*/
+static bool internal_node_rebalance(Table* table, void* parent, uint32_t left_index,
+                                    uint32_t left_page_num, void* left,
+                                    uint32_t right_page_num, void* right){
+    Pager* pager = table->pager;
+    uint64_t keys[2 * INTERNAL_NODE_MAX_CELLS + 1];
+    uint32_t children[2 * INTERNAL_NODE_MAX_CELLS + 2];
+    uint32_t left_count = internal_node_read(left, keys, children);
+    // the bound of left's right child is the parent's key for left
+    keys[left_count - 1] = internal_node_key(parent, left_index);
+    uint32_t count = left_count + internal_node_read(right, keys + left_count, children + left_count);
+    if (internal_node_keys_fit(keys, count - 1)) {
+        internal_node_write(left, keys, children, count);
+        for (uint32_t i = left_count; i < count; i++) {
+            set_node_parent(get_page(pager, children[i]), left_page_num);
+            pager_mark_dirty(pager, children[i]);
+        }
+        return true;
+    }
+    uint32_t split = count / 2;
+    if (!internal_node_keys_fit(keys, split - 1) ||
+        !internal_node_keys_fit(keys + split, count - split - 1) ||
+        !internal_node_can_set_key(parent, keys[split - 1])) {
+        return false;
+    }
+    internal_node_write(left, keys, children, split);
+    internal_node_write(right, keys + split, children + split, count - split);
+    internal_node_replace_key(parent, left_index, keys[split - 1]);
+    // children that changed sides point at their new parent
+    for (uint32_t i = split; i < left_count; i++) {
+        set_node_parent(get_page(pager, children[i]), right_page_num);
+        pager_mark_dirty(pager, children[i]);
+    }
+    for (uint32_t i = left_count; i < split; i++) {
+        set_node_parent(get_page(pager, children[i]), left_page_num);
+        pager_mark_dirty(pager, children[i]);
+    }
+    return false;
+}
+
+// a root left with a single child takes the child's place
+static void btree_collapse_root(Table* table){
+    Pager* pager = table->pager;
+    void* root = table_latch_for_write(table, table->root_page_num);
+    uint32_t child_page_num = *internal_node_right_child(root);
+    void* child = table_latch_for_write(table, child_page_num);
+    memcpy(root, child, PAGE_SIZE);
+    set_node_root(root, true);
+    *node_parent(root) = 0;
+    pager_mark_dirty(pager, table->root_page_num);
+    if (get_node_type(root) == NODE_INTERNAL) {
+        for (uint32_t i = 0; i <= *internal_node_num_keys(root); i++) {
+            uint32_t grandchild_page_num = *internal_node_child(root, i);
+            set_node_parent(get_page(pager, grandchild_page_num), table->root_page_num);
+            pager_mark_dirty(pager, grandchild_page_num);
+        }
+    }
+    free_page_num(pager, child_page_num);
+}
+
+/*
+    Fix a node a delete left underfull, with its sibling under the same
+    parent: a merge takes the parent's key for the pair out, so the
+    parent may need fixing in turn. table_find_for_delete kept the
+    parent latched, the sibling is latched here, top down as always.
+*/
+static void btree_rebalance(Table* table, uint32_t page_num){
+    Pager* pager = table->pager;
+    uint32_t parent_page_num = *node_parent(get_page(pager, page_num));
+    void* parent = table_latch_for_write(table, parent_page_num);
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    if (num_keys == 0)
+        return;
+    uint32_t index = internal_node_child_index(parent, page_num);
+    uint32_t left_index = index == num_keys ? index - 1 : index;
+    uint32_t left_page_num = *internal_node_child(parent, left_index);
+    uint32_t right_page_num = *internal_node_child(parent, left_index + 1);
+    void* left = table_latch_for_write(table, left_page_num);
+    void* right = table_latch_for_write(table, right_page_num);
+    pager_mark_dirty(pager, parent_page_num);
+    pager_mark_dirty(pager, left_page_num);
+    pager_mark_dirty(pager, right_page_num);
+    bool merged = get_node_type(left) == NODE_LEAF
+                      ? leaf_node_rebalance(parent, left_index, left, right)
+                      : internal_node_rebalance(table, parent, left_index, left_page_num, left,
+                                                right_page_num, right);
+    if (!merged)
+        return;
+    stats_add(&table->stats.merges, 1);
+    // left now covers both, it takes right's place and left's cell goes
+    *internal_node_child(parent, left_index + 1) = left_page_num;
+    internal_node_remove_cell(parent, left_index);
+    internal_node_compact_keys(parent);
+    free_page_num(pager, right_page_num);
+    if (is_node_root(parent)) {
+        if (*internal_node_num_keys(parent) == 0)
+            btree_collapse_root(table);
+    } else if (*internal_node_num_keys(parent) < INTERNAL_NODE_MIN_KEYS) {
+        btree_rebalance(table, parent_page_num);
+    }
+}
+
+ExecuteResult execute_delete(Statement *statement, Table *table)
+{
+    Pager* pager = table->pager;
+    uint64_t key = statement->target.id;
+    Cursor* cursor = table_find_for_delete(table, key);
+    void* node = get_page(pager, cursor->page_num);
+    ExecuteResult result = EXECUTE_ROW_NOT_FOUND;
+    if (cursor->cell_num < *leaf_node_num_cells(node) &&
+        *leaf_node_key(node, cursor->cell_num) == key) {
+        leaf_node_free_overflow(table, node, cursor->cell_num);
+        leaf_node_remove_cell(node, cursor->cell_num);
+        pager_mark_dirty(pager, cursor->page_num);
+        if (!is_node_root(node) && leaf_node_used_space(node) < LEAF_NODE_MIN_USED)
+            btree_rebalance(table, cursor->page_num);
+        result = EXECUTE_SUCCESS;
+    }
+    table_release_write_latches(table, 0);
+    return result;
+}
+
+/*
+    The key does not change, so the row is rewritten in its cell's place
+    on the same leaf. Only a row that grew past the leaf's free space
+    splits it, as an insert would.
+*/
+ExecuteResult execute_update(Statement *statement, Table *table)
+{
+    Pager* pager = table->pager;
+    RowTarget* target = &statement->target;
+    // the new row's size is only known once the old one is read
+    Cursor* cursor = table_find_for_write(table, target->id, LEAF_NODE_MAX_CELL_SIZE);
+    void* node = get_page(pager, cursor->page_num);
+    ExecuteResult result = EXECUTE_ROW_NOT_FOUND;
+    if (cursor->cell_num < *leaf_node_num_cells(node) &&
+        *leaf_node_key(node, cursor->cell_num) == target->id) {
+        Row row;
+        deserialize_row(target->id, leaf_node_payload(pager, node, cursor->cell_num), &row);
+        for (uint32_t i = 0; i < target->num_columns; i++) {
+            if (target->columns[i] == COLUMN_USERNAME)
+                memcpy(row.username, statement->row_to_insert.username, COLUMN_USERNAME_SIZE);
+            else if (target->columns[i] == COLUMN_EMAIL)
+                memcpy(row.email, statement->row_to_insert.email, COLUMN_EMAIL_SIZE);
+        }
+        leaf_node_free_overflow(table, node, cursor->cell_num);
+        leaf_node_remove_cell(node, cursor->cell_num);
+        pager_mark_dirty(pager, cursor->page_num);
+        leaf_node_insert(cursor, target->id, &row);
+        result = EXECUTE_SUCCESS;
+    }
+    table_release_write_latches(table, 0);
+    return result;
+}
+
+// formatting rows is timed only while there is a slow statement log
+static void select_print_row(Table* table, uint64_t key, const void* payload,
+                             const SelectPredicate* select)
+{
+    if (table->slow_log == NULL) {
+        print_row_view(key, payload, select);
+        return;
+    }
+    uint64_t start = stats_now_nsec();
+    print_row_view(key, payload, select);
+    statement_trace.output_nsec += stats_now_nsec() - start;
+}
+
+ExecuteResult execute_select(Statement *statement, Table *table)
+{
+    SelectPredicate* select = &statement->select;
+    if (select->start_id == select->end_id) {
+        // point lookup: one descent, no read-ahead
+        Cursor* cursor = table_seek(table, select->start_id);
+        void* node = cursor->node;
+        if (select->limit > 0 && cursor->cell_num < cursor->num_cells &&
+            *leaf_node_key(node, cursor->cell_num) == select->start_id) {
+            select_print_row(table, select->start_id,
+                             leaf_node_payload(table->pager, node, cursor->cell_num), select);
+            stats_add(&table->stats.statements[STATEMENT_SELECT].rows, 1);
+        }
+        pager_unlatch(table->pager, cursor->page_num);
+        return EXECUTE_SUCCESS;
+    }
+    // seek to the first key in range and stop at the end of it
+    Cursor* cursor = scan_start(table, select->start_id);
+    uint32_t rows_returned = 0;
+    while (!(cursor->end_of_table) && rows_returned < select->limit) {
+        uint64_t key = *leaf_node_key(cursor->node, cursor->cell_num);
+        if (key > select->end_id)
+            break;
+        select_print_row(table, key, scan_value(cursor), select);
+        rows_returned++;
+        scan_advance(cursor);
+    }
+    scan_close(cursor);
+    stats_add(&table->stats.statements[STATEMENT_SELECT].rows, rows_returned);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+    One line per statement that took the slow log threshold or longer,
+    in microseconds: the whole statement, then its phases. "other" is
+    what the phases do not cover, searching the tree and waiting for
+    the writer mutex among it.
+*/
+static void slow_log_write(Table* table, StatementType type, uint64_t execute_nsec)
+{
+    StatementTrace* trace = &statement_trace;
+    uint64_t total = trace->prepare_nsec + execute_nsec;
+    if (total < table->slow_log_nsec)
+        return;
+    uint64_t phases = trace->io_nsec + trace->split_nsec + trace->commit_nsec + trace->output_nsec;
+    uint64_t other = execute_nsec > phases ? execute_nsec - phases : 0;
+    fprintf(table->slow_log,
+            "slow %s: %" PRIu64 " us prepare %" PRIu64 " io %" PRIu64 " split %" PRIu64
+            " commit %" PRIu64 " output %" PRIu64 " other %" PRIu64
+            " pages %" PRIu32 " read %" PRIu32 ": %s\n",
+            statement_type_names[type], total / 1000, trace->prepare_nsec / 1000,
+            trace->io_nsec / 1000, trace->split_nsec / 1000, trace->commit_nsec / 1000,
+            trace->output_nsec / 1000, other / 1000, trace->pages_touched, trace->pages_read,
+            trace->text[0] != '\0' ? trace->text : "(prepared)");
+    fflush(table->slow_log);
+}
+
+/*
+    Log statements taking threshold_usec or longer, prepare included,
+    to log. NULL turns the log off; log stays the caller's to close.
+*/
+void table_set_slow_log(Table* table, uint64_t threshold_usec, FILE* log)
+{
+    table->slow_log_nsec = threshold_usec * 1000;
+    table->slow_log = log;
+}
+
+ExecuteResult execute_statement(Statement *statement, Table *table)
+{
+    TRACE_PROBE1(execute_start, statement->type);
+    uint64_t start = stats_now_nsec();
+    StatementStats* stats = &table->stats.statements[statement->type];
+    ExecuteResult result = EXECUTE_SUCCESS;
+    StatementTrace* trace = &statement_trace;
+    trace->io_nsec = trace->split_nsec = trace->commit_nsec = trace->output_nsec = 0;
+    trace->pages_touched = trace->pages_read = 0;
+    switch (statement->type)
+    {
+    case STATEMENT_INSERT:
+    case STATEMENT_DELETE:
+    case STATEMENT_UPDATE:
+        // one writer at a time, outside begin ... commit every
+        // statement is its own transaction
+        pthread_mutex_lock(&table->writer);
+        result = statement->type == STATEMENT_INSERT ? execute_insert(statement, table)
+               : statement->type == STATEMENT_DELETE ? execute_delete(statement, table)
+               : execute_update(statement, table);
+        uint64_t commit_start = stats_now_nsec();
+        uint64_t commit = table->in_transaction ? 0 : pager_commit(table->pager);
+        pager_unpin_recent(table->pager);
+        pthread_mutex_unlock(&table->writer);
+        // past the writer mutex, so the next writer's commit can share the sync
+        table_sync_commit(table, commit);
+        if (commit != 0)
+            trace->commit_nsec = stats_now_nsec() - commit_start;
+        statement_arena_reset();
+        if (result == EXECUTE_SUCCESS)
+            stats_add(&stats->rows, statement->rows != NULL ? statement->num_rows : 1);
+        break;
+    case STATEMENT_SELECT:
+        result = execute_select(statement, table);
+        pager_unpin_recent(table->pager);
+        statement_arena_reset();
+        break;
+    case STATEMENT_BEGIN:
+        result = table_begin(table);
+        break;
+    case STATEMENT_COMMIT:
+        result = table_commit(table);
+        break;
+    }
+    uint64_t elapsed = stats_now_nsec() - start;
+    histogram_record(&stats->latency, elapsed);
+    TRACE_PROBE3(execute_done, statement->type, result, elapsed);
+    if (table->slow_log != NULL)
+        slow_log_write(table, statement->type, elapsed);
+    // a prepared statement executed next has no text of its own
+    trace->text[0] = '\0';
+    trace->prepare_nsec = 0;
+    return result;
+}
+
+/*
+    Begin a transaction. The writer mutex is kept until table_commit,
+    so the statements in between are written by this thread alone and
+    pages they change again and again are logged once, at commit.
+    Scans from other threads wait to begin their snapshot until then.
+    There is no rollback: closing the table commits an open transaction.
+*/
+ExecuteResult table_begin(Table* table)
+{
+    pthread_mutex_lock(&table->writer);
+    if (table->in_transaction)
+    {
+        pthread_mutex_unlock(&table->writer);
+        return EXECUTE_ALREADY_IN_TRANSACTION;
+    }
+    table->in_transaction = true;
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult table_commit(Table* table)
+{
+    pthread_mutex_lock(&table->writer);
+    if (!table->in_transaction)
+    {
+        pthread_mutex_unlock(&table->writer);
+        return EXECUTE_NOT_IN_TRANSACTION;
+    }
+    table->in_transaction = false;
+    uint64_t commit = pager_commit(table->pager);
+    // this call's lock and the one table_begin kept
+    pthread_mutex_unlock(&table->writer);
+    pthread_mutex_unlock(&table->writer);
+    table_sync_commit(table, commit);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+    A statement reports success once its commit is on disk, unless
+    table->defer_sync is set: then the log syncs at least every
+    group_commit_size commits and table_sync syncs the rest.
+*/
+void table_sync_commit(Table* table, uint64_t commit)
+{
+    if (!table->defer_sync)
+        pager_sync_commit(table->pager, commit);
+}
+
+void table_sync(Table* table)
+{
+    if (table->pager->wal != NULL)
+        wal_sync(table->pager->wal);
+}
+
+
+Cursor* table_start(Table* table){
+    // the smallest key lives in the leftmost leaf
+    Cursor* cursor = table_find(table, 0);
+    void* node = get_page(table->pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    cursor->end_of_table = (num_cells==0);
+    return cursor;
+}
+
+Cursor* table_find(Table* table,uint64_t key){
+    //Return the position of the given key.
+    // the key is not present, 
+    // return the positionwhere it should be inserted
+    // No latches: for the writer and single threaded callers, readers
+    // running next to a writer use table_seek or scan_start.
+    uint32_t root_page_num =  table->root_page_num;
+    void* root_node = get_page(table->pager,root_page_num);
+    if (get_node_type(root_node)==NODE_LEAF){
+        return leaf_node_find(table, root_page_num, key);
+    }else{
+        return internal_node_find(table, root_page_num, key);
+    }
+}
+
+uint32_t internal_node_find_child(void* node, uint64_t key)
+{
+  /*
+    Return the index of the child which should contain
+    the given key.
+  */
+  uint32_t num_keys = *internal_node_num_keys(node);
+  /* there is one more child than key, num_keys means the right child */
+  if (internal_node_is_wide(node))
+    return key_lower_bound64(internal_node_keys(node), num_keys, key);
+  // a narrow node only has to search its keys if key has the same prefix
+  uint32_t prefix = *internal_node_key_prefix(node);
+  if (key >> 32 != prefix)
+    return key >> 32 < prefix ? 0 : num_keys;
+  return key_lower_bound(internal_node_keys(node), num_keys, (uint32_t)key);
+}
+
+Cursor* internal_node_find(Table* table, uint32_t page_num, uint64_t key)
+{
+  void* node = get_page(table->pager, page_num);
+  uint32_t child_index = internal_node_find_child(node, key);
+  uint32_t child_num = *internal_node_child(node, child_index);
+  void* child = get_page(table->pager, child_num);
+  if (get_node_type(child) == NODE_LEAF) {
+    return leaf_node_find(table, child_num, key);
+  }
+  return internal_node_find(table, child_num, key);
+}
+
+Cursor* leaf_node_find(Table* table, uint32_t page_num, uint64_t key)
+{
+  void* node = get_page(table->pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  Cursor* cursor = cursor_alloc();
+  cursor->table = table;
+  cursor->page_num = page_num;
+  cursor->end_of_table = false;
+  cursor->node = NULL;
+
+  // the position of key, or where it should be inserted
+  cursor->cell_num = key_lower_bound64(leaf_node_keys(node), num_cells, key);
+  return cursor;
+}
+
+uint64_t get_node_max_key(Pager* pager, void* node){
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+    }
+    void* right_child = get_page(pager, *internal_node_right_child(node));
+    return get_node_max_key(pager, right_child);
+}
+
+void leaf_node_split_and_insert(Cursor* cursor,uint64_t key,const void* cell,uint32_t cell_size){
+    /*
+        Create a new node and move half the cells over.
+        Insert the new value in one of the two nodes.
+        Update parent or create a new parent.
+    */
+   Pager* pager = cursor->table->pager;
+   // pin the old leaf so fetching the new page cannot evict it
+   void* old_node = pager_pin(pager,cursor->page_num);
+   uint64_t old_max = get_node_max_key(pager, old_node);
+   uint32_t new_page_num =  get_unused_page_num(pager);
+   void* new_node = table_latch_for_write(cursor->table, new_page_num);
+   stats_add(&cursor->table->stats.leaf_splits, 1);
+   TRACE_PROBE2(leaf_split, cursor->page_num, new_page_num);
+   pager_mark_dirty(pager, cursor->page_num);
+   pager_mark_dirty(pager, new_page_num);
+   initialize_leaf_node(new_node);
+   *node_parent(new_node) = *node_parent(old_node);
+   *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+   *leaf_node_next_leaf(old_node) = new_page_num;
+    /*
+        All existing cells plus the new one are divided by size, not
+        count, so both leaves end up about half full. The old leaf is
+        rebuilt from a copy of itself.
+    */
+    uint8_t old_cells[PAGE_SIZE];
+    memcpy(old_cells, old_node, PAGE_SIZE);
+    uint32_t num_cells = *leaf_node_num_cells(old_cells) + 1;
+    const uint32_t per_cell = LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE;
+    uint32_t total_bytes = cell_size + per_cell;
+    for (uint32_t i = 0; i + 1 < num_cells; i++)
+        total_bytes += leaf_node_cell_size(old_cells, i) + per_cell;
+    *leaf_node_num_cells(old_node) = 0;
+    *leaf_node_content_start(old_node) = PAGE_SIZE;
+    void* destination_node = old_node;
+    uint32_t left_bytes = 0;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        uint64_t source_key = key;
+        const void* source = cell;
+        uint32_t size = cell_size;
+        if (i != cursor->cell_num) {
+            uint32_t old_index = i < cursor->cell_num ? i : i - 1;
+            source_key = *leaf_node_key(old_cells, old_index);
+            source = leaf_node_cell(old_cells, old_index);
+            size = leaf_node_cell_size(old_cells, old_index);
+        }
+        if (destination_node == old_node && left_bytes >= total_bytes / 2)
+            destination_node = new_node;
+        leaf_node_append_cell(destination_node, source_key, source, size);
+        left_bytes += size + per_cell;
+    }
+    bool is_root = is_node_root(old_node);
+    uint32_t parent_page_num = *node_parent(old_node);
+    pager_unpin(pager,cursor->page_num);
+    if (is_root) {
+        create_new_root(cursor->table, new_page_num);
+        return;
+    }
+    internal_node_replace_child(cursor->table, parent_page_num, old_max, new_page_num);
+    internal_node_insert(cursor->table, parent_page_num, cursor->page_num);
+}
+
+/*
+    After a split the parent's key for the old node, old_max, belongs
+    to the new node, which takes over that cell. The old node is then
+    inserted again with its new max. Keys already in a node are never
+    lowered in place: a prefix compressed node may have no room to
+    widen for the new key, while an insert can always split first.
+*/
+void internal_node_replace_child(Table* table, uint32_t parent_page_num, uint64_t old_max,
+                                 uint32_t new_child_page_num){
+    void* parent = get_page(table->pager, parent_page_num);
+    uint32_t index = internal_node_find_child(parent, old_max);
+    *internal_node_child(parent, index) = new_child_page_num;
+    pager_mark_dirty(table->pager, parent_page_num);
+}
+
+void create_new_root(Table* table, uint32_t right_child_page_num){
+    /*
+        Handle splitting the root.
+        Old root copied to new page, becomes left child.
+        Address of right child passed in.
+        Re-initialize root page to contain the new root node.
+        New root node points to two children.
+    */
+    Pager* pager = table->pager;
+    void* root = pager_pin(pager, table->root_page_num);
+    void* right_child = pager_pin(pager, right_child_page_num);
+    uint32_t left_child_page_num = get_unused_page_num(pager);
+    void* left_child = table_latch_for_write(table, left_child_page_num);
+    pager_mark_dirty(pager, table->root_page_num);
+    pager_mark_dirty(pager, right_child_page_num);
+    pager_mark_dirty(pager, left_child_page_num);
+    if (get_node_type(root) == NODE_INTERNAL) {
+        initialize_internal_node(right_child);
+        initialize_internal_node(left_child);
+    }
+    /* Left child has data copied from old root */
+    memcpy(left_child, root, PAGE_SIZE);
+    set_node_root(left_child, false);
+    if (get_node_type(left_child) == NODE_INTERNAL) {
+        // the moved node's children must point at their new parent
+        uint32_t child_page_num;
+        for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++) {
+            child_page_num = *internal_node_child(left_child, i);
+            set_node_parent(get_page(pager, child_page_num), left_child_page_num);
+            pager_mark_dirty(pager, child_page_num);
+        }
+    }
+    /* Root node is a new internal node with one key and two children */
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    uint64_t left_child_max_key = get_node_max_key(pager, left_child);
+    internal_node_reserve_key(root, left_child_max_key);
+    *internal_node_num_keys(root) = 1;
+    *internal_node_cell(root, 0) = left_child_page_num;
+    internal_node_set_key(root, 0, left_child_max_key);
+    *internal_node_right_child(root) = right_child_page_num;
+    *node_parent(left_child) = table->root_page_num;
+    *node_parent(right_child) = table->root_page_num;
+    pager_unpin(pager, right_child_page_num);
+    pager_unpin(pager, table->root_page_num);
+}
+
+void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num){
+    /*
+        Add a new child/key pair to parent that corresponds to child
+    */
+    Pager* pager = table->pager;
+    void* parent = get_page(pager, parent_page_num);
+    void* child = get_page(pager, child_page_num);
+    uint64_t child_max_key = get_node_max_key(pager, child);
+    parent = get_page(pager, parent_page_num);
+    uint32_t index = internal_node_find_child(parent, child_max_key);
+
+    uint32_t original_num_keys = *internal_node_num_keys(parent);
+    uint32_t right_child_page_num = *internal_node_right_child(parent);
+    /*
+        An internal node with a right child of INVALID_PAGE_NUM is empty
+    */
+    if (right_child_page_num == INVALID_PAGE_NUM) {
+        *internal_node_right_child(parent) = child_page_num;
+        pager_mark_dirty(pager, parent_page_num);
+        return;
+    }
+
+    void* right_child = get_page(pager, right_child_page_num);
+    uint64_t right_child_max_key = get_node_max_key(pager, right_child);
+    parent = get_page(pager, parent_page_num);
+    // the key that goes in: the old right child's if the child replaces it
+    bool replace_right_child = child_max_key > right_child_max_key;
+    uint64_t new_key = replace_right_child ? right_child_max_key : child_max_key;
+    if (!internal_node_reserve_key(parent, new_key)) {
+        internal_node_split_and_insert(table, parent_page_num, child_page_num);
+        return;
+    }
+    pager_mark_dirty(pager, parent_page_num);
+    *internal_node_num_keys(parent) = original_num_keys + 1;
+
+    if (replace_right_child) {
+        /* Replace right child */
+        *internal_node_cell(parent, original_num_keys) = right_child_page_num;
+        internal_node_set_key(parent, original_num_keys, right_child_max_key);
+        *internal_node_right_child(parent) = child_page_num;
+    } else {
+        /* Make room for the new cell in both the child and the key array */
+        internal_node_open_cell(parent, index, original_num_keys);
+        *internal_node_cell(parent, index) = child_page_num;
+        internal_node_set_key(parent, index, child_max_key);
+    }
+}
+
+void internal_node_split_and_insert(Table* table, uint32_t parent_page_num,
+                                    uint32_t child_page_num){
+    Pager* pager = table->pager;
+    stats_add(&table->stats.internal_splits, 1);
+    TRACE_PROBE1(internal_split, parent_page_num);
+    uint32_t old_page_num = parent_page_num;
+    void* old_node = get_page(pager, parent_page_num);
+    uint64_t old_max = get_node_max_key(pager, old_node);
+
+    void* child = get_page(pager, child_page_num);
+    uint64_t child_max = get_node_max_key(pager, child);
+
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = table_latch_for_write(table, new_page_num);
+
+    /*
+        Declaring a flag before updating pointers which
+        records whether this operation involves splitting the root -
+        if it does, we will insert our newly created node during
+        the step where the table's new root is created. If it does
+        not, we have to insert the newly created node into its parent
+        after the old node's keys have been transferred over. We are not
+        able to do this if the newly created node's parent is not a newly
+        initialized root node, because in that case its parent may have
+        existing keys aside from our old node which we are splitting. If
+        that is true, we need to find a place for our newly created node
+        in its parent, and we cannot insert it at the correct index if it
+        does not yet have any keys
+    */
+    bool splitting_root = is_node_root(old_node);
+
+    void* parent;
+    if (splitting_root) {
+        create_new_root(table, new_page_num);
+        parent = get_page(pager, table->root_page_num);
+        /*
+            If we are splitting the root, we need to update old_node to point
+            to the new root's left child, new_page_num will already point to
+            the new root's right child
+        */
+        old_page_num = *internal_node_child(parent, 0);
+    } else {
+        initialize_internal_node(new_node);
+        pager_mark_dirty(pager, new_page_num);
+    }
+    old_node = pager_pin(pager, old_page_num);
+    pager_mark_dirty(pager, old_page_num);
+    uint32_t* old_num_keys = internal_node_num_keys(old_node);
+
+    uint32_t cur_page_num = *internal_node_right_child(old_node);
+
+    /*
+        First put right child into new node and set right child of old node to
+        invalid page number
+    */
+    internal_node_insert(table, new_page_num, cur_page_num);
+    set_node_parent(get_page(pager, cur_page_num), new_page_num);
+    pager_mark_dirty(pager, cur_page_num);
+    *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
+    /*
+        For each key until you get to the middle key, move the key and the child
+        to the new node. A node is split when full, or when a narrow node
+        needs a key outside its prefix but has too many keys to widen.
+    */
+    uint32_t num_keys = *old_num_keys;
+    for (uint32_t i = num_keys - 1; i > num_keys / 2; i--) {
+        cur_page_num = *internal_node_child(old_node, i);
+        internal_node_insert(table, new_page_num, cur_page_num);
+        set_node_parent(get_page(pager, cur_page_num), new_page_num);
+        pager_mark_dirty(pager, cur_page_num);
+        (*old_num_keys)--;
+    }
+
+    /*
+        Set child before middle key, which is now the highest key, to be node's
+        right child, and decrement number of keys
+    */
+    *internal_node_right_child(old_node) = *internal_node_child(old_node, *old_num_keys - 1);
+    (*old_num_keys)--;
+    internal_node_compact_keys(old_node);
+
+    /*
+        Determine which of the two nodes after the split should contain the child
+        to be inserted, and insert the child
+    */
+    uint64_t max_after_split = get_node_max_key(pager, old_node);
+    uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
+    internal_node_insert(table, destination_page_num, child_page_num);
+    set_node_parent(get_page(pager, child_page_num), destination_page_num);
+    pager_mark_dirty(pager, child_page_num);
+
+    uint32_t old_parent_page_num = *node_parent(old_node);
+    uint64_t new_max = get_node_max_key(pager, old_node);
+    pager_unpin(pager, old_page_num);
+
+    if (splitting_root) {
+        // the new root's only key is still old_max, a single key always fits
+        parent = get_page(pager, old_parent_page_num);
+        internal_node_encode(parent, INTERNAL_NODE_NARROW_KEY_SIZE, new_max >> 32);
+        internal_node_set_key(parent, 0, new_max);
+        pager_mark_dirty(pager, old_parent_page_num);
+        return;
+    }
+    *node_parent(get_page(pager, new_page_num)) = old_parent_page_num;
+    pager_mark_dirty(pager, new_page_num);
+    internal_node_replace_child(table, old_parent_page_num, old_max, new_page_num);
+    internal_node_insert(table, old_parent_page_num, old_page_num);
+}
+
+static int compare_row_ids(const void* a, const void* b){
+    uint64_t left = ((const Row*)a)->id;
+    uint64_t right = ((const Row*)b)->id;
+    return (left > right) - (left < right);
+}
+
+/*
+    Insert rows, sorted in place by id, through one cursor: while the
+    next row belongs on the leaf the last one went to and fits there,
+    it goes in without descending from the root again. That leaf stays
+    latched between rows. The rows go in all or none, the ones already
+    inserted are deleted again when an id turns out to be taken.
+*/
+ExecuteResult table_insert_rows(Table* table, Row* rows, uint32_t num_rows){
+    qsort(rows, num_rows, sizeof(Row), compare_row_ids);
+    for (uint32_t i = 1; i < num_rows; i++) {
+        if (rows[i].id == rows[i - 1].id)
+            return EXECUTE_DUPLICATE_KEY;
+    }
+    Pager* pager = table->pager;
+    Cursor* cursor = NULL;
+    ExecuteResult result = EXECUTE_SUCCESS;
+    uint32_t inserted = 0;
+    // one descent's cursor at a time, however many rows there are
+    ArenaMark mark = arena_mark(&statement_arena);
+    for (; inserted < num_rows; inserted++) {
+        Row* row = &rows[inserted];
+        uint32_t cell_size = leaf_cell_size(row_payload_size(row));
+        uint32_t needed = cell_size + LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE;
+        void* node = cursor == NULL ? NULL : get_page(pager, cursor->page_num);
+        uint32_t num_cells = node == NULL ? 0 : *leaf_node_num_cells(node);
+        // ids only grow, so the row stays on this leaf unless it is past
+        // the leaf's last key and another leaf follows
+        if (node != NULL && leaf_node_free_space(node) >= needed &&
+            (*leaf_node_next_leaf(node) == 0 ||
+             (num_cells > 0 && row->id < *leaf_node_key(node, num_cells - 1)))) {
+            cursor->cell_num = key_lower_bound64(leaf_node_keys(node), num_cells, row->id);
+        } else {
+            table_release_write_latches(table, 0);
+            arena_rewind(&statement_arena, mark);
+            cursor = table_find_for_write(table, row->id, cell_size);
+            node = get_page(pager, cursor->page_num);
+            num_cells = *leaf_node_num_cells(node);
+        }
+        if (cursor->cell_num < num_cells && *leaf_node_key(node, cursor->cell_num) == row->id) {
+            result = EXECUTE_DUPLICATE_KEY;
+            break;
+        }
+        bool splits = leaf_node_free_space(node) < needed;
+        leaf_node_insert(cursor, row->id, row);
+        if (splits) {
+            // the row may now be on either half, find the next one afresh
+            cursor = NULL;
+        }
+    }
+    table_release_write_latches(table, 0);
+    arena_rewind(&statement_arena, mark);
+    if (result != EXECUTE_SUCCESS) {
+        Statement statement;
+        statement.type = STATEMENT_DELETE;
+        for (uint32_t i = 0; i < inserted; i++) {
+            statement.target.id = rows[i].id;
+            execute_delete(&statement, table);
+        }
+    }
+    return result;
+}
+
+static uint32_t bulk_load_per_node(uint32_t max_per_node, double fill_factor){
+    if (fill_factor <= 0 || fill_factor > 1)
+        fill_factor = 1;
+    uint32_t per_node = max_per_node * fill_factor;
+    return per_node == 0 ? 1 : per_node;
+}
+
+/*
+    Write one level of internal nodes above `children` and return it
+    in place. Nodes go to fresh pages except when a single node is left,
+    which becomes the root on table->root_page_num. A node whose keys
+    do not share a 32 bit prefix is stored wide and takes at most
+    wide_fanout children.
+*/
+static uint32_t bulk_load_internal_level(Table* table, BulkLoadEntry* children,
+                                         uint32_t num_children, uint32_t fanout,
+                                         uint32_t wide_fanout){
+    Pager* pager = table->pager;
+    uint32_t next_child = 0;
+    uint32_t num_nodes = 0;
+    while (next_child < num_children) {
+        // spread children evenly so the last node is not left nearly empty
+        uint32_t remaining = num_children - next_child;
+        uint32_t nodes_left = (remaining + fanout - 1) / fanout;
+        uint32_t count = (remaining + nodes_left - 1) / nodes_left;
+        if (count > wide_fanout &&
+            children[next_child].max_key >> 32 != children[next_child + count - 2].max_key >> 32) {
+            count = wide_fanout;
+        }
+        uint32_t page_num = count == num_children ? table->root_page_num : get_unused_page_num(pager);
+        // pinned: every child is fetched to fix its parent pointer
+        void* node = pager_pin(pager, page_num);
+        pager_mark_dirty(pager, page_num);
+        initialize_internal_node(node);
+        for (uint32_t i = 0; i < count; i++) {
+            BulkLoadEntry* child = &children[next_child + i];
+            if (i == count - 1) {
+                *internal_node_right_child(node) = child->page_num;
+            } else {
+                internal_node_reserve_key(node, child->max_key);
+                *internal_node_cell(node, i) = child->page_num;
+                internal_node_set_key(node, i, child->max_key);
+                *internal_node_num_keys(node) = i + 1;
+            }
+            *node_parent(get_page(pager, child->page_num)) = page_num;
+            pager_mark_dirty(pager, child->page_num);
+        }
+        pager_unpin(pager, page_num);
+        uint64_t max_key = children[next_child + count - 1].max_key;
+        children[num_nodes].page_num = page_num;
+        children[num_nodes].max_key = max_key;
+        num_nodes++;
+        next_child += count;
+    }
+    return num_nodes;
+}
+
+/*
+    Build the tree bottom-up from rows: leaves are packed to fill_factor
+    in key order onto consecutive pages, then each internal level is
+    written above them. Only an empty table can be bulk loaded this way,
+    otherwise the rows go through table_insert_rows. rows is sorted
+    in place.
+*/
+static ExecuteResult bulk_load_rows(Table* table, Row* rows, uint32_t num_rows, double fill_factor){
+    qsort(rows, num_rows, sizeof(Row), compare_row_ids);
+    for (uint32_t i = 1; i < num_rows; i++) {
+        if (rows[i].id == rows[i - 1].id)
+            return EXECUTE_DUPLICATE_KEY;
+    }
+    Pager* pager = table->pager;
+    void* root = get_page(pager, table->root_page_num);
+    if (get_node_type(root) != NODE_LEAF || *leaf_node_num_cells(root) != 0)
+        return table_insert_rows(table, rows, num_rows);
+    if (num_rows == 0)
+        return EXECUTE_SUCCESS;
+    // readers wait at the root until the whole tree is written
+    table_latch_for_write(table, table->root_page_num);
+
+    /*
+        Leaves are packed by bytes: a leaf is closed once the next cell
+        would take it past fill_factor of its space. The boundaries are
+        found first so that a table fitting one leaf is written to the root.
+    */
+    if (fill_factor <= 0 || fill_factor > 1)
+        fill_factor = 1;
+    uint32_t leaf_budget = LEAF_NODE_SPACE_FOR_CELLS * fill_factor;
+    uint32_t* leaf_counts = malloc(num_rows * sizeof(uint32_t));
+    uint32_t num_leaves = 0;
+    uint32_t leaf_bytes = 0;
+    for (uint32_t i = 0; i < num_rows; i++) {
+        uint32_t size = leaf_cell_size(row_payload_size(&rows[i])) +
+                        LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE;
+        if (num_leaves == 0 || (leaf_bytes > 0 && leaf_bytes + size > leaf_budget)) {
+            leaf_counts[num_leaves++] = 0;
+            leaf_bytes = 0;
+        }
+        leaf_counts[num_leaves - 1]++;
+        leaf_bytes += size;
+    }
+    BulkLoadEntry* level = malloc(num_leaves * sizeof(BulkLoadEntry));
+    uint8_t cell[LEAF_NODE_MAX_CELL_SIZE];
+    uint32_t next_row = 0;
+    for (uint32_t n = 0; n < num_leaves; n++) {
+        uint32_t count = leaf_counts[n];
+        uint32_t page_num = num_leaves == 1 ? table->root_page_num : get_unused_page_num(pager);
+        // pinned: a spilled payload fetches overflow pages
+        void* node = pager_pin(pager, page_num);
+        pager_mark_dirty(pager, page_num);
+        initialize_leaf_node(node);
+        for (uint32_t i = 0; i < count; i++) {
+            Row* row = &rows[next_row + i];
+            uint32_t cell_size = leaf_node_build_cell(table, row, cell);
+            leaf_node_append_cell(node, row->id, cell, cell_size);
+        }
+        pager_unpin(pager, page_num);
+        if (n > 0) {
+            *leaf_node_next_leaf(get_page(pager, level[n - 1].page_num)) = page_num;
+            pager_mark_dirty(pager, level[n - 1].page_num);
+        }
+        level[n].page_num = page_num;
+        level[n].max_key = rows[next_row + count - 1].id;
+        next_row += count;
+    }
+    free(leaf_counts);
+
+    uint32_t fanout = bulk_load_per_node(INTERNAL_NODE_MAX_CELLS, fill_factor) + 1;
+    uint32_t wide_fanout = bulk_load_per_node(INTERNAL_NODE_WIDE_MAX_CELLS, fill_factor) + 1;
+    uint32_t level_size = num_leaves;
+    while (level_size > 1) {
+        level_size = bulk_load_internal_level(table, level, level_size, fanout, wide_fanout);
+    }
+    free(level);
+    root = get_page(pager, table->root_page_num);
+    set_node_root(root, true);
+    *node_parent(root) = 0;
+    pager_mark_dirty(pager, table->root_page_num);
+    table_release_write_latches(table, 0);
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult table_bulk_load(Table* table, Row* rows, uint32_t num_rows, double fill_factor){
+    pthread_mutex_lock(&table->writer);
+    ExecuteResult result = bulk_load_rows(table, rows, num_rows, fill_factor);
+    pager_unpin_recent(table->pager);
+    pthread_mutex_unlock(&table->writer);
+    return result;
+}
+
+/*
+    Read "<id> <username> <email>" lines from filename and bulk load them.
+*/
+void import_rows(Table* table, const char* filename, double fill_factor){
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Unable to open file with name %s \n", filename);
+        return;
+    }
+    uint32_t capacity = 1024;
+    uint32_t num_rows = 0;
+    Row* rows = malloc(capacity * sizeof(Row));
+    char line[512];
+    uint32_t line_num = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_num++;
+        if (line[0] == '\n' || line[0] == '\0')
+            continue;
+        if (num_rows == capacity) {
+            capacity *= 2;
+            rows = realloc(rows, capacity * sizeof(Row));
+        }
+        Row* row = &rows[num_rows];
+        // as long as the line, so an overlong field is seen rather than cut
+        char username[sizeof(line)];
+        char email[sizeof(line)];
+        if (sscanf(line, "%" SCNu64 " %511s %511s", &row->id, username, email) < 3) {
+            printf("Syntax error on line %d of %s\n", line_num, filename);
+            fclose(file);
+            free(rows);
+            return;
+        }
+        size_t username_length = strlen(username);
+        size_t email_length = strlen(email);
+        if (username_length > COLUMN_USERNAME_SIZE || email_length > COLUMN_EMAIL_SIZE) {
+            printf("String is too long on line %d of %s\n", line_num, filename);
+            fclose(file);
+            free(rows);
+            return;
+        }
+        // zero padded like prepare_insert, a field of the full size has no terminator
+        memset(row->username, 0, COLUMN_USERNAME_SIZE);
+        memset(row->email, 0, COLUMN_EMAIL_SIZE);
+        memcpy(row->username, username, username_length);
+        memcpy(row->email, email, email_length);
+        num_rows++;
+    }
+    fclose(file);
+    pthread_mutex_lock(&table->writer);
+    ExecuteResult result = table_bulk_load(table, rows, num_rows, fill_factor);
+    uint64_t commit = table->in_transaction ? 0 : pager_commit(table->pager);
+    pthread_mutex_unlock(&table->writer);
+    table_sync_commit(table, commit);
+    switch (result) {
+    case EXECUTE_SUCCESS:
+        printf("Imported %d rows.\n", num_rows);
+        break;
+    case EXECUTE_DUPLICATE_KEY:
+        printf("Error: Duplicate key.\n");
+        break;
+    case EXECUTE_TABLE_FULL:
+        printf("Table is full\n");
+        break;
+    default:
+        break;
+    }
+    free(rows);
+}
+
+/*
+    New pages are taken off the freelist and only go onto the end of
+    the database file once it is empty. Each call hands out a different
+    page, the caller is expected to use it.
+*/
+uint32_t get_unused_page_num(Pager* pager) {
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    uint32_t page_num = *db_header_freelist_head(header);
+    if (page_num == 0)
+        return pager->num_pages;
+    *db_header_freelist_head(header) = *free_page_next(get_page(pager, page_num));
+    (*db_header_free_pages(header))--;
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+    return page_num;
+}
+
+// put a page the tree no longer reaches on the freelist
+void free_page_num(Pager* pager, uint32_t page_num) {
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    void* page = get_page(pager, page_num);
+    // open snapshots may still read what the page held
+    pager_save_version(pager, page_num, page);
+    set_node_type(page, NODE_FREE);
+    set_node_root(page, false);
+    *node_parent(page) = 0;
+    *free_page_next(page) = *db_header_freelist_head(header);
+    *db_header_freelist_head(header) = page_num;
+    (*db_header_free_pages(header))++;
+    pager_mark_dirty(pager, page_num);
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+}
+
+/*
+    Gather the rows below page_num in key order. Every node is latched
+    exclusively once before it is read, parents before children, so a
+    reader that was already below the root when the vacuum latched it
+    has moved past the node by then and cannot come back.
+*/
+static void vacuum_collect_rows(Table* table, uint32_t page_num, Row** rows,
+                                uint32_t* num_rows, uint32_t* capacity){
+    Pager* pager = table->pager;
+    if (page_num != table->root_page_num) {
+        pager_latch(pager, page_num, LATCH_EXCLUSIVE);
+        pager_unlatch(pager, page_num);
+    }
+    void* node = pager_pin(pager, page_num);
+    if (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        for (uint32_t i = 0; i <= num_keys; i++)
+            vacuum_collect_rows(table, *internal_node_child(node, i), rows, num_rows, capacity);
+    } else {
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        for (uint32_t i = 0; i < num_cells; i++) {
+            if (*num_rows == *capacity) {
+                *capacity *= 2;
+                *rows = realloc(*rows, *capacity * sizeof(Row));
+            }
+            deserialize_row(*leaf_node_key(node, i), leaf_node_payload(pager, node, i),
+                            &(*rows)[(*num_rows)++]);
+        }
+    }
+    pager_unpin(pager, page_num);
+}
+
+/*
+    Rebuild the table onto the pages right after the root, leaves in key
+    order, packed full, and truncate the file behind them. The freelist
+    is dropped with the old pages. With the log this is one transaction,
+    so a crash leaves either the old tree or the new one.
+*/
+void table_vacuum(Table* table){
+    Pager* pager = table->pager;
+    pthread_mutex_lock(&table->writer);
+    // the rebuild commits, which would make half a transaction durable
+    if (table->in_transaction) {
+        printf("Cannot vacuum inside a transaction.\n");
+        pthread_mutex_unlock(&table->writer);
+        return;
+    }
+    // snapshots read the old pages, which are about to be overwritten
+    pthread_mutex_lock(&pager->mutex);
+    bool snapshots_open = pager->versions->num_snapshots > 0;
+    pthread_mutex_unlock(&pager->mutex);
+    if (snapshots_open) {
+        printf("Cannot vacuum while a scan is open.\n");
+        pthread_mutex_unlock(&table->writer);
+        return;
+    }
+    // readers wait at the root until the new tree is written
+    void* root = table_latch_for_write(table, table->root_page_num);
+    uint32_t capacity = 1024;
+    uint32_t num_rows = 0;
+    Row* rows = malloc(capacity * sizeof(Row));
+    vacuum_collect_rows(table, table->root_page_num, &rows, &num_rows, &capacity);
+
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    *db_header_freelist_head(header) = 0;
+    *db_header_free_pages(header) = 0;
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+    initialize_leaf_node(root);
+    set_node_root(root, true);
+    *node_parent(root) = 0;
+    pager_mark_dirty(pager, table->root_page_num);
+    // new pages are handed out from right after the root again
+    pthread_mutex_lock(&pager->mutex);
+    pager->num_pages = table->root_page_num + 1;
+    pthread_mutex_unlock(&pager->mutex);
+    bulk_load_rows(table, rows, num_rows, 1);
+    table_release_write_latches(table, 0);
+    free(rows);
+
+    pager_commit(pager);
+    pager_unpin_recent(pager);
+    pager_truncate(pager, pager->num_pages);
+    pthread_mutex_unlock(&table->writer);
+}
\ No newline at end of file
@@ -2,8 +2,15 @@
 #define CONSTANTS_H_
 
 #include "../input_buffer.h"
+#include "wal.h"
+#include "mvcc.h"
+#include "arena.h"
+#include "uring.h"
+#include "stats.h"
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
 #ifndef TERMINATE_CMD
 #define TERMINATE_CMD ".quit"
 #endif
@@ -13,14 +20,50 @@
 #ifndef COLUMN_EMAIL_SIZE
 #define COLUMN_EMAIL_SIZE 255
 #endif
-#ifndef TABLE_MAX_PAGES
-#define TABLE_MAX_PAGES 100
+#ifndef PAGER_DEFAULT_FRAMES
+#define PAGER_DEFAULT_FRAMES 100
+#endif
+#ifndef PAGER_MIN_FRAMES
+#define PAGER_MIN_FRAMES 32
+#endif
+#define INVALID_FRAME UINT32_MAX
+// most adjacent dirty pages written by one pwritev
+#ifndef PAGER_FLUSH_MAX_RUN
+#define PAGER_FLUSH_MAX_RUN 64
+#endif
+// pages the file grows by when a mapped pager runs past its end
+#ifndef PAGER_MMAP_GROW_PAGES
+#define PAGER_MMAP_GROW_PAGES 256
+#endif
+// virtual address space reserved for a mapped pager (64 GiB)
+#ifndef PAGER_MMAP_DEFAULT_RESERVE
+#define PAGER_MMAP_DEFAULT_RESERVE ((size_t)1 << 36)
+#endif
+#ifndef BULK_LOAD_DEFAULT_FILL_FACTOR
+#define BULK_LOAD_DEFAULT_FILL_FACTOR 1.0
+#endif
+// pages get_page keeps pinned for the calling thread, see get_page
+#ifndef PAGER_RECENT_PINS
+#define PAGER_RECENT_PINS 16
+#endif
+// pages a write statement can hold latched: its path down the tree
+// and the nodes its splits create
+#ifndef TABLE_MAX_WRITE_LATCHES
+#define TABLE_MAX_WRITE_LATCHES 32
+#endif
+// leaves read ahead of a scan cursor
+#ifndef SCAN_PREFETCH_LEAVES
+#define SCAN_PREFETCH_LEAVES 8
+#endif
+// statement text kept for the slow statement log, longer text is cut
+#ifndef SLOW_LOG_MAX_TEXT
+#define SLOW_LOG_MAX_TEXT 256
 #endif
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
 
 typedef struct
 {
-    uint32_t id;
+    uint64_t id;
     char username[COLUMN_USERNAME_SIZE];
     char email[COLUMN_EMAIL_SIZE];
 } Row;
@@ -36,83 +79,423 @@ typedef enum
 {
     PREPARE_SUCCESS,
     PREPARE_UNRECOGNIZED_STATEMENT,
-    PREPARE_SYNTAX_ERROR
+    PREPARE_SYNTAX_ERROR,
+    PREPARE_NEGATIVE_ID,
+    PREPARE_STRING_TOO_LONG
 } PrepareResult;
 
 typedef enum
 {
     STATEMENT_INSERT,
-    STATEMENT_SELECT
+    STATEMENT_SELECT,
+    STATEMENT_DELETE,
+    STATEMENT_UPDATE,
+    STATEMENT_BEGIN,
+    STATEMENT_COMMIT
 } StatementType;
 
+#define NUM_STATEMENT_TYPES (STATEMENT_COMMIT + 1)
+
 typedef enum
 {
     EXECUTE_SUCCESS,
     EXECUTE_DUPLICATE_KEY,
-    EXECUTE_TABLE_FULL
+    EXECUTE_TABLE_FULL,
+    EXECUTE_ROW_NOT_FOUND,
+    EXECUTE_ALREADY_IN_TRANSACTION,
+    EXECUTE_NOT_IN_TRANSACTION
 
 } ExecuteResult;
 
+typedef enum
+{
+    COLUMN_ID,
+    COLUMN_USERNAME,
+    COLUMN_EMAIL
+} Column;
+
+#define MAX_SELECT_COLUMNS 3
+
+/*
+    "select [* | column, ...] [where id = N | where id between A and B]
+    [limit N]"
+*/
+typedef struct
+{
+    uint64_t start_id;
+    uint64_t end_id;
+    uint32_t limit;
+    Column columns[MAX_SELECT_COLUMNS];
+    uint32_t num_columns;
+} SelectPredicate;
+
+// a length-delimited view of a string field inside a page, not terminated
+typedef struct
+{
+    const char* data;
+    uint32_t length;
+} FieldSlice;
+
+/*
+    "delete where id = N" and
+    "update set column = value[, column = value] where id = N"
+*/
+typedef struct
+{
+    uint64_t id;
+    // update only: the columns to set, their values are in row_to_insert
+    Column columns[MAX_SELECT_COLUMNS];
+    uint32_t num_columns;
+} RowTarget;
+
 typedef struct
 {
     Row row_to_insert;
+    // "insert values (...), (...)" only, NULL otherwise, see statement_release
+    Row* rows;
+    uint32_t num_rows;
+    SelectPredicate select;
+    RowTarget target;
     StatementType type;
 } Statement;
 
+// the places a ? in a prepared statement binds its value to
+typedef enum
+{
+    PARAM_ROW_ID,
+    PARAM_USERNAME,
+    PARAM_EMAIL,
+    PARAM_SELECT_ID,
+    PARAM_SELECT_START,
+    PARAM_SELECT_END,
+    PARAM_SELECT_LIMIT,
+    PARAM_TARGET_ID
+} ParamSlot;
+
+#ifndef MAX_STATEMENT_PARAMS
+#define MAX_STATEMENT_PARAMS 4
+#endif
+
+/*
+    A compiled statement, "insert ? ? ?" or "select where id = ?": the
+    parsed statement and the slot of each ? in the text, in order.
+    Bound values are written into statement and are kept across
+    executions until bound again.
+*/
+typedef struct
+{
+    Statement statement;
+    ParamSlot params[MAX_STATEMENT_PARAMS];
+    uint32_t num_params;
+} PreparedStatement;
+
+#ifndef PLAN_CACHE_SIZE
+#define PLAN_CACHE_SIZE 32
+#endif
+
+typedef struct
+{
+    // NULL while the entry is unused
+    char* text;
+    uint32_t hash;
+    uint64_t last_used;
+    PreparedStatement plan;
+} PlanCacheEntry;
+
+// compiled statements by their text, the least recently used goes first
+typedef struct
+{
+    pthread_mutex_t mutex;
+    PlanCacheEntry entries[PLAN_CACHE_SIZE];
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+} PlanCache;
+
+
+// A buffer pool slot. Unpinned frames are kept on an LRU list
+// (head = most recently used) and the tail is evicted first.
+typedef struct {
+    void* data;
+    uint32_t page_num;
+    uint32_t pin_count;
+    bool in_use;
+    bool dirty;
+    uint32_t lru_prev;
+    uint32_t lru_next;
+    uint32_t hash_next;
+    // the page latch, only taken while the frame is pinned
+    pthread_rwlock_t latch;
+} Frame;
+
+typedef enum
+{
+    LATCH_SHARED,
+    LATCH_EXCLUSIVE
+} LatchMode;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t prefetches;
+    // pages loaded into frames from the file or the log
+    uint64_t pages_read;
+    // pages written to the file or appended to the log, and their bytes
+    uint64_t pages_written;
+    uint64_t bytes_flushed;
+} PagerStats;
+
+typedef enum
+{
+    PAGER_MODE_BUFFERED,
+    PAGER_MODE_MMAP
+} PagerMode;
+
+// how a buffered pager moves pages between its frames and the file
+typedef enum
+{
+    PAGER_IO_SYNC,
+    // batched through an io_uring, plain system calls where there is none
+    PAGER_IO_URING
+} PagerIo;
+
+typedef struct {
+    PagerMode mode;
+    uint32_t num_frames;
+    size_t mmap_reserve;
+    // write-ahead log, buffered mode only
+    bool use_wal;
+    uint32_t group_commit_size;
+    // buffered mode only
+    PagerIo io;
+    // O_DIRECT: the buffer pool is the only cache of the file's pages
+    bool direct_io;
+} PagerConfig;
 
 typedef struct {
     int file_descriptor;
-    uint32_t file_length;
+    off_t file_length;
     uint32_t  num_pages;
-    void* pages[TABLE_MAX_PAGES];
+    PagerMode mode;
+    // PAGER_MODE_MMAP: the file is mapped at map, which reserves
+    // map_reserve bytes so page pointers stay valid while it grows
+    void* map;
+    size_t map_reserve;
+    // guards the frame table, LRU list, stats and the log, page
+    // contents are guarded by the frame latches
+    pthread_mutex_t mutex;
+    // in mapped mode frames carry no data, only the page latches
+    uint32_t num_frames;
+    uint32_t frames_used;
+    void* frame_data;
+    Frame* frames;
+    // page_num -> frame index, chained through Frame.hash_next
+    uint32_t* buckets;
+    uint32_t num_buckets;
+    uint32_t lru_head;
+    uint32_t lru_tail;
+    Wal* wal;
+    char* wal_path;
+    // PAGER_IO_URING: batches flushes, checkpoints and read-ahead
+    IoRing* ring;
+    bool direct_io;
+    // commits so far, a snapshot reads the database as of one of them
+    uint64_t last_commit;
+    VersionStore* versions;
+    PagerStats stats;
 } Pager;
 
+// per statement type: how long it took, and the rows it read or wrote
+typedef struct
+{
+    Histogram latency;
+    uint64_t rows;
+} StatementStats;
+
+// counters of a table, bumped with stats_add as readers run concurrently
+typedef struct
+{
+    uint64_t leaf_splits;
+    uint64_t internal_splits;
+    uint64_t merges;
+    StatementStats statements[NUM_STATEMENT_TYPES];
+} TableStats;
+
 typedef struct
 {
     uint32_t root_page_num;
     Pager* pager;
-
+    // one writer at a time, readers only take page latches
+    pthread_mutex_t writer;
+    // pages the current write statement holds exclusively, top down
+    uint32_t write_latches[TABLE_MAX_WRITE_LATCHES];
+    uint32_t num_write_latches;
+    // between begin and commit: the writer mutex is held and write
+    // statements leave committing to table_commit
+    bool in_transaction;
+    // write statements return before their commit is synced, see
+    // table_sync_commit
+    bool defer_sync;
+    PlanCache plans;
+    TableStats stats;
+    // statements taking slow_log_nsec or longer are logged to
+    // slow_log, none while it is NULL; slow_log_file is one .slowlog opened
+    uint64_t slow_log_nsec;
+    FILE* slow_log;
+    FILE* slow_log_file;
 } Table;
 
+// a node written by the bulk loader, as seen by the level above it
+typedef struct {
+    uint32_t page_num;
+    uint64_t max_key;
+} BulkLoadEntry;
+
+// a copy of every counter of a table, see table_stats
+typedef struct
+{
+    PagerStats pager;
+    TableStats table;
+    uint64_t wal_syncs;
+    uint64_t plan_cache_hits;
+    uint64_t plan_cache_misses;
+    uint32_t num_pages;
+    uint32_t tree_height;
+} EngineStats;
+
+/*
+    Cursors from table_find, table_start, table_seek and leaf_node_find
+    come from the calling thread's statement arena: they are not freed,
+    and stay valid until statement_arena_reset, which every
+    execute_statement ends with. Scan cursors are closed with scan_close.
+*/
 typedef struct {
     Table* table;
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table; 
+    /*
+        Scan cursors only (scan_start): node is a private copy of the
+        current leaf as of commit snapshot, and the leaves after it are
+        prefetched from the parent's child list up to prefetched_index.
+    */
+    uint64_t snapshot;
+    void* node;
+    uint32_t num_cells;
+    uint32_t parent_page_num;
+    uint32_t child_index;
+    uint32_t prefetched_index;
 } Cursor;
 
 Table *db_open(const char* );
-Pager* pager_open(const char* );
+Table *db_open_with_config(const char* ,const PagerConfig* );
+void db_close(Table* );
+Pager* pager_open(const char* ,const PagerConfig* );
+void pager_close(Pager* );
+uint64_t pager_commit(Pager* );
+void pager_sync_commit(Pager* pager, uint64_t commit);
+void pager_checkpoint(Pager* );
+void pager_flush_dirty(Pager* );
+void pager_truncate(Pager* ,uint32_t );
+void pager_mark_dirty(Pager* ,uint32_t );
 Cursor* table_start(Table* );
-Cursor* table_find(Table* ,uint32_t);
-Cursor* leaf_node_find(Table* , uint32_t , uint32_t );
+Cursor* table_find(Table* ,uint64_t);
+Cursor* leaf_node_find(Table* , uint32_t , uint64_t );
+Cursor* internal_node_find(Table* , uint32_t , uint64_t );
+uint32_t internal_node_find_child(void* , uint64_t );
 void* get_page(Pager* ,uint32_t );
+void* pager_pin(Pager* ,uint32_t );
+void pager_unpin(Pager* ,uint32_t );
+void pager_unpin_recent(Pager* );
+void* pager_latch(Pager* ,uint32_t ,LatchMode );
+void* pager_try_latch(Pager* ,uint32_t ,LatchMode );
+void pager_unlatch(Pager* ,uint32_t );
+uint64_t pager_begin_snapshot(Pager* );
+void pager_end_snapshot(Pager* ,uint64_t );
+void pager_read_snapshot(Pager* ,uint64_t ,uint32_t ,void* );
+void pager_save_version(Pager* ,uint32_t ,const void* );
+void* table_latch_for_write(Table* ,uint32_t );
+void table_release_write_latches(Table* ,uint32_t );
+void table_release_write_latch(Table* ,uint32_t );
+Cursor* table_seek(Table* ,uint64_t );
+bool table_get(Table* ,uint64_t ,Row* );
+void statement_arena_reset(void);
+void statement_arena_release(void);
 void free_table(Table *);
 ExecuteResult execute_statement(Statement *, Table *);
 ExecuteResult execute_insert(Statement *, Table *);
 ExecuteResult execute_select(Statement *, Table *);
+ExecuteResult execute_delete(Statement *, Table *);
+ExecuteResult execute_update(Statement *, Table *);
+ExecuteResult table_insert_rows(Table* ,Row* ,uint32_t );
+ExecuteResult table_begin(Table* );
+ExecuteResult table_commit(Table* );
+void table_sync_commit(Table* table, uint64_t commit);
+void table_sync(Table* table);
 PrepareResult prepare_statement(InputBuffer *, Statement *);
+PrepareResult statement_compile(const char* ,PreparedStatement* );
+void statement_release(Statement* );
+PrepareResult table_prepare(Table* ,const char* ,PreparedStatement* );
+PrepareResult prepared_bind_int(PreparedStatement* ,uint32_t ,uint64_t );
+PrepareResult prepared_bind_text(PreparedStatement* ,uint32_t ,const char* );
+ExecuteResult prepared_execute(PreparedStatement* ,Table* );
 MetaCommandResult do_meta_command(InputBuffer *,Table* );
-void  leaf_node_split_and_insert(Cursor*,u_int32_t,Row*);
+void table_stats(Table* ,EngineStats* );
+void table_set_slow_log(Table* ,uint64_t ,FILE* );
+void print_stats(const EngineStats* );
+void  leaf_node_split_and_insert(Cursor*,uint64_t,const void*,uint32_t);
+void create_new_root(Table* ,uint32_t );
+void internal_node_replace_child(Table* ,uint32_t ,uint64_t ,uint32_t );
+void internal_node_insert(Table* ,uint32_t ,uint32_t );
+void internal_node_split_and_insert(Table* ,uint32_t ,uint32_t );
+uint64_t get_node_max_key(Pager* ,void* );
+void print_tree(Pager* ,uint32_t ,uint32_t );
+ExecuteResult table_bulk_load(Table* ,Row* ,uint32_t ,double );
+void import_rows(Table* ,const char* ,double );
 uint32_t get_unused_page_num(Pager* );
+void free_page_num(Pager* ,uint32_t );
+void table_vacuum(Table* );
 void print_row(Row *row);
 void serialize_row(Row *, void *);
-void deserialize_row(void *, Row *);
+void deserialize_row(uint64_t ,void *, Row *);
+uint32_t row_payload_size(Row* );
+uint32_t leaf_node_build_cell(Table* ,Row* ,void* );
+void* leaf_node_payload(Pager* ,void* ,uint32_t );
+FieldSlice row_view_username(const void* );
+FieldSlice row_view_email(const void* );
+void print_row_view(uint64_t ,const void* ,const SelectPredicate* );
 void* cursor_value(Cursor* );
 void advance_cursor(Cursor* );
-void leaf_node_insert(Cursor* ,uint32_t , Row* );
+Cursor* scan_start(Table* ,uint64_t );
+void* scan_value(Cursor* );
+void scan_advance(Cursor* );
+uint64_t scan_key(Cursor* );
+void scan_close(Cursor* );
+void pager_prefetch(Pager* ,uint32_t* ,uint32_t );
+void leaf_node_insert(Cursor* ,uint64_t , Row* );
 void pager_flush(Pager* , uint32_t );
 
 
-const uint32_t ID_SIZE = size_of_attribute(Row, id);
-const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+static const uint32_t ID_SIZE = size_of_attribute(Row, id);
+static const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
+static const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
+static const uint32_t ID_OFFSET = 0;
+static const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
+static const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
+static const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+
+/*
+    A row is stored as a variable length payload: the two string
+    lengths followed by the bytes of each string. The id is the cell key.
+*/
+static const uint32_t PAYLOAD_LENGTH_SIZE = sizeof(uint16_t);
+static const uint32_t PAYLOAD_USERNAME_LENGTH_OFFSET = 0;
+static const uint32_t PAYLOAD_EMAIL_LENGTH_OFFSET = PAYLOAD_USERNAME_LENGTH_OFFSET + PAYLOAD_LENGTH_SIZE;
+static const uint32_t PAYLOAD_HEADER_SIZE = PAYLOAD_EMAIL_LENGTH_OFFSET + PAYLOAD_LENGTH_SIZE;
+static const uint32_t MAX_PAYLOAD_SIZE = PAYLOAD_HEADER_SIZE + USERNAME_SIZE + EMAIL_SIZE;
 
-const uint32_t PAGE_SIZE = 4096;
+static const uint32_t PAGE_SIZE = 4096;
 
 
 #endif //CONSTANTS_H_
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mvcc.h"
+
+static uint32_t version_bucket(uint32_t page_num)
+{
+    return (page_num * 2654435761u) % MVCC_VERSION_BUCKETS;
+}
+
+VersionStore* version_store_open(uint32_t page_size)
+{
+    VersionStore* store = malloc(sizeof(VersionStore));
+    store->page_size = page_size;
+    memset(store->buckets, 0, sizeof(store->buckets));
+    store->num_versions = 0;
+    store->num_snapshots = 0;
+    store->snapshots_capacity = 8;
+    store->snapshots = malloc(store->snapshots_capacity * sizeof(uint64_t));
+    return store;
+}
+
+void version_store_add_snapshot(VersionStore* store, uint64_t commit)
+{
+    if (store->num_snapshots == store->snapshots_capacity) {
+        store->snapshots_capacity *= 2;
+        store->snapshots = realloc(store->snapshots, store->snapshots_capacity * sizeof(uint64_t));
+    }
+    store->snapshots[store->num_snapshots++] = commit;
+}
+
+/*
+    Drop a snapshot and every version no open snapshot can read any
+    more: one that is valid until a commit at or before the oldest.
+*/
+void version_store_remove_snapshot(VersionStore* store, uint64_t commit)
+{
+    for (uint32_t i = 0; i < store->num_snapshots; i++) {
+        if (store->snapshots[i] == commit) {
+            store->snapshots[i] = store->snapshots[--store->num_snapshots];
+            break;
+        }
+    }
+    uint64_t oldest = UINT64_MAX;
+    for (uint32_t i = 0; i < store->num_snapshots; i++) {
+        if (store->snapshots[i] < oldest)
+            oldest = store->snapshots[i];
+    }
+    for (uint32_t b = 0; b < MVCC_VERSION_BUCKETS; b++) {
+        PageVersion** link = &store->buckets[b];
+        while (*link != NULL) {
+            PageVersion* version = *link;
+            if (version->valid_until <= oldest) {
+                *link = version->next;
+                free(version);
+                store->num_versions--;
+            } else {
+                link = &version->next;
+            }
+        }
+    }
+}
+
+/*
+    Keep page as the image valid until commit valid_until. Nothing is
+    kept without open snapshots, nor when the page already has a
+    version newer than every snapshot: that one is what they all read.
+*/
+void version_store_save(VersionStore* store, uint32_t page_num, uint64_t valid_until, const void* page)
+{
+    if (store->num_snapshots == 0)
+        return;
+    uint64_t newest = 0;
+    for (uint32_t i = 0; i < store->num_snapshots; i++) {
+        if (store->snapshots[i] > newest)
+            newest = store->snapshots[i];
+    }
+    uint32_t bucket = version_bucket(page_num);
+    for (PageVersion* version = store->buckets[bucket]; version != NULL; version = version->next) {
+        if (version->page_num == page_num && version->valid_until > newest)
+            return;
+    }
+    PageVersion* version = malloc(sizeof(PageVersion) + store->page_size);
+    if (version == NULL) {
+        printf("Unable to allocate page version\n");
+        exit(EXIT_FAILURE);
+    }
+    version->page_num = page_num;
+    version->valid_until = valid_until;
+    memcpy(version->data, page, store->page_size);
+    version->next = store->buckets[bucket];
+    store->buckets[bucket] = version;
+    store->num_versions++;
+}
+
+// the image of page_num a snapshot at commit `snapshot` reads, NULL for the live page
+const void* version_store_find(VersionStore* store, uint32_t page_num, uint64_t snapshot)
+{
+    PageVersion* found = NULL;
+    for (PageVersion* version = store->buckets[version_bucket(page_num)]; version != NULL;
+         version = version->next) {
+        if (version->page_num == page_num && version->valid_until > snapshot &&
+            (found == NULL || version->valid_until < found->valid_until)) {
+            found = version;
+        }
+    }
+    return found == NULL ? NULL : found->data;
+}
+
+void version_store_close(VersionStore* store)
+{
+    for (uint32_t b = 0; b < MVCC_VERSION_BUCKETS; b++) {
+        PageVersion* version = store->buckets[b];
+        while (version != NULL) {
+            PageVersion* next = version->next;
+            free(version);
+            version = next;
+        }
+    }
+    free(store->snapshots);
+    free(store);
+}
@@ -0,0 +1,45 @@
+#ifndef MVCC_H_
+#define MVCC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef MVCC_VERSION_BUCKETS
+#define MVCC_VERSION_BUCKETS 256
+#endif
+
+/*
+    Page versions for snapshot reads. While snapshots are open, the
+    writer keeps the committed image of a page before it first changes
+    it, tagged with the commit that replaces it. A snapshot taken at
+    commit S reads each page from the version with the smallest
+    valid_until above S, or from the live page when there is none.
+*/
+typedef struct PageVersion
+{
+    uint32_t page_num;
+    // the first commit this image does not include
+    uint64_t valid_until;
+    struct PageVersion* next;
+    uint8_t data[];
+} PageVersion;
+
+typedef struct
+{
+    uint32_t page_size;
+    PageVersion* buckets[MVCC_VERSION_BUCKETS];
+    uint32_t num_versions;
+    // the commits open snapshots read at, one entry per snapshot
+    uint64_t* snapshots;
+    uint32_t num_snapshots;
+    uint32_t snapshots_capacity;
+} VersionStore;
+
+VersionStore* version_store_open(uint32_t page_size);
+void version_store_add_snapshot(VersionStore* store, uint64_t commit);
+void version_store_remove_snapshot(VersionStore* store, uint64_t commit);
+void version_store_save(VersionStore* store, uint32_t page_num, uint64_t valid_until, const void* page);
+const void* version_store_find(VersionStore* store, uint32_t page_num, uint64_t snapshot);
+void version_store_close(VersionStore* store);
+
+#endif // MVCC_H_
@@ -0,0 +1,150 @@
+#include <stddef.h>
+#include "search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEY_SEARCH_X86 1
+#endif
+
+// count of keys below key, the keys are sorted so they form a prefix
+typedef uint32_t (*CountBelowKernel)(const uint32_t* keys, uint32_t num_keys, uint32_t key);
+typedef uint32_t (*CountBelowKernel64)(const uint64_t* keys, uint32_t num_keys, uint64_t key);
+
+static uint32_t count_below_scalar(const uint32_t* keys, uint32_t num_keys, uint32_t key)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < num_keys; i++)
+        count += keys[i] < key;
+    return count;
+}
+
+static uint32_t count_below_scalar64(const uint64_t* keys, uint32_t num_keys, uint64_t key)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < num_keys; i++)
+        count += keys[i] < key;
+    return count;
+}
+
+#ifdef KEY_SEARCH_X86
+/*
+    There are no unsigned 32 bit compares before AVX-512, so both sides
+    are biased by 2^31 and compared as signed. Keys are loaded unaligned:
+    these kernels only search the narrow keys of internal nodes, which sit
+    right after the 22 byte internal node header. Leaf keys are 64 bit and
+    go through key_lower_bound64.
+*/
+static uint32_t count_below_sse2(const uint32_t* keys, uint32_t num_keys, uint32_t key)
+{
+    const __m128i bias = _mm_set1_epi32((int)0x80000000u);
+    const __m128i target = _mm_xor_si128(_mm_set1_epi32((int)key), bias);
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= num_keys; i += 4) {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), bias);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(target, block)));
+        count += __builtin_popcount(mask);
+    }
+    return count + count_below_scalar(keys + i, num_keys - i, key);
+}
+
+__attribute__((target("avx2")))
+static uint32_t count_below_avx2(const uint32_t* keys, uint32_t num_keys, uint32_t key)
+{
+    const __m256i bias = _mm256_set1_epi32((int)0x80000000u);
+    const __m256i target = _mm256_xor_si256(_mm256_set1_epi32((int)key), bias);
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= num_keys; i += 8) {
+        __m256i block = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), bias);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(target, block)));
+        count += __builtin_popcount(mask);
+    }
+    return count + count_below_sse2(keys + i, num_keys - i, key);
+}
+
+// 64 bit compares need SSE4.2 at least
+__attribute__((target("sse4.2")))
+static uint32_t count_below_sse42(const uint64_t* keys, uint32_t num_keys, uint64_t key)
+{
+    const __m128i bias = _mm_set1_epi64x((long long)0x8000000000000000ull);
+    const __m128i target = _mm_xor_si128(_mm_set1_epi64x((long long)key), bias);
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 2 <= num_keys; i += 2) {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), bias);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(target, block)));
+        count += __builtin_popcount(mask);
+    }
+    return count + count_below_scalar64(keys + i, num_keys - i, key);
+}
+
+__attribute__((target("avx2")))
+static uint32_t count_below_avx2_64(const uint64_t* keys, uint32_t num_keys, uint64_t key)
+{
+    const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ull);
+    const __m256i target = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), bias);
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= num_keys; i += 4) {
+        __m256i block = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), bias);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(target, block)));
+        count += __builtin_popcount(mask);
+    }
+    return count + count_below_scalar64(keys + i, num_keys - i, key);
+}
+#endif
+
+static CountBelowKernel count_below = NULL;
+static CountBelowKernel64 count_below64 = NULL;
+
+static void choose_kernels()
+{
+    count_below = count_below_scalar;
+    count_below64 = count_below_scalar64;
+#ifdef KEY_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        count_below = count_below_sse2;
+    if (__builtin_cpu_supports("sse4.2"))
+        count_below64 = count_below_sse42;
+    if (__builtin_cpu_supports("avx2")) {
+        count_below = count_below_avx2;
+        count_below64 = count_below_avx2_64;
+    }
+#endif
+}
+
+uint32_t key_lower_bound(const uint32_t* keys, uint32_t num_keys, uint32_t key)
+{
+    if (count_below == NULL)
+        choose_kernels();
+    uint32_t min_index = 0;
+    uint32_t max_index = num_keys;
+    while (max_index - min_index > KEY_SEARCH_WINDOW) {
+        uint32_t index = min_index + (max_index - min_index) / 2;
+        if (keys[index] >= key) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index + count_below(keys + min_index, max_index - min_index, key);
+}
+
+uint32_t key_lower_bound64(const uint64_t* keys, uint32_t num_keys, uint64_t key)
+{
+    if (count_below64 == NULL)
+        choose_kernels();
+    uint32_t min_index = 0;
+    uint32_t max_index = num_keys;
+    while (max_index - min_index > KEY_SEARCH_WINDOW) {
+        uint32_t index = min_index + (max_index - min_index) / 2;
+        if (keys[index] >= key) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index + count_below64(keys + min_index, max_index - min_index, key);
+}
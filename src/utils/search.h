@@ -0,0 +1,22 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include <stdint.h>
+
+// keys left in the search window when the binary search hands over to a kernel
+#ifndef KEY_SEARCH_WINDOW
+#define KEY_SEARCH_WINDOW 32
+#endif
+
+/*
+    In-node key search. Both node types keep their keys in a contiguous
+    sorted array, which is narrowed by binary search and then finished
+    by counting the keys below the target with SIMD compares. The kernels
+    (AVX2, then SSE2 for 32 bit or SSE4.2 for 64 bit keys, else scalar)
+    are picked for the running CPU on first use.
+*/
+// index of the first of num_keys sorted keys that is >= key, num_keys if none
+uint32_t key_lower_bound(const uint32_t* keys, uint32_t num_keys, uint32_t key);
+uint32_t key_lower_bound64(const uint64_t* keys, uint32_t num_keys, uint64_t key);
+
+#endif // SEARCH_H_
@@ -0,0 +1,65 @@
+#include <math.h>
+#include <stdbool.h>
+#include <time.h>
+#include "stats.h"
+
+uint64_t stats_now_nsec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static uint32_t histogram_bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return value;
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    // the 4 bits below the leading one pick the step within the power of two
+    uint32_t step = (value >> (exponent - 4)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (exponent - 3) * HISTOGRAM_SUB_BUCKETS + step;
+}
+
+// the smallest value that falls into bucket
+static uint64_t histogram_bucket_floor(uint32_t bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+    uint32_t exponent = bucket / HISTOGRAM_SUB_BUCKETS + 3;
+    uint64_t step = bucket % HISTOGRAM_SUB_BUCKETS;
+    return (1ull << exponent) | (step << (exponent - 4));
+}
+
+void histogram_record(Histogram* histogram, uint64_t value)
+{
+    stats_add(&histogram->counts[histogram_bucket(value)], 1);
+    stats_add(&histogram->total, 1);
+    stats_add(&histogram->sum, value);
+    uint64_t max = stats_load(&histogram->max);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&histogram->max, &max, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void histogram_copy(Histogram* to, const Histogram* from)
+{
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        to->counts[i] = stats_load(&from->counts[i]);
+    to->total = stats_load(&from->total);
+    to->sum = stats_load(&from->sum);
+    to->max = stats_load(&from->max);
+}
+
+// the lower bound of the bucket holding the value at percentile
+uint64_t histogram_percentile(const Histogram* histogram, double percentile)
+{
+    uint64_t rank = (uint64_t)ceil(histogram->total * percentile / 100.0);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank && seen > 0)
+            return histogram_bucket_floor(i);
+    }
+    return histogram->max;
+}
@@ -0,0 +1,39 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+
+// latency histogram: every power of two of nanoseconds in 16 steps
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+/*
+    Counters that threads bump without a lock. Updates are relaxed
+    atomic adds, so recording costs a few instructions and a reader
+    polling them sees each counter exact but not all of them as of one
+    instant.
+*/
+typedef struct
+{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} Histogram;
+
+static inline void stats_add(uint64_t* counter, uint64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stats_load(const uint64_t* counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_now_nsec(void);
+void histogram_record(Histogram* histogram, uint64_t value);
+void histogram_copy(Histogram* to, const Histogram* from);
+uint64_t histogram_percentile(const Histogram* histogram, double percentile);
+
+#endif // STATS_H_
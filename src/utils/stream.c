@@ -1,66 +0,0 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include "stream.h"
-
-size_t getline(char **lineptr, size_t *n, FILE *stream)
-{
-    char *bufptr = NULL;
-    char *p = bufptr;
-    size_t size;
-    int c;
-
-    if (lineptr == NULL)
-    {
-        return -1;
-    }
-    if (stream == NULL)
-    {
-        return -1;
-    }
-    if (n == NULL)
-    {
-        return -1;
-    }
-    bufptr = *lineptr;
-    size = *n;
-
-    c = fgetc(stream);
-    if (c == EOF)
-    {
-        return -1;
-    }
-    if (bufptr == NULL)
-    {
-        bufptr = malloc(128);
-        if (bufptr == NULL)
-        {
-            return -1;
-        }
-        size = 128;
-    }
-    p = bufptr;
-    while (c != EOF)
-    {
-        if ((p - bufptr) > (size - 1))
-        {
-            size = size + 128;
-            bufptr = realloc(bufptr, size);
-            if (bufptr == NULL)
-            {
-                return -1;
-            }
-        }
-        *p++ = c;
-        if (c == '\n')
-        {
-            break;
-        }
-        c = fgetc(stream);
-    }
-
-    *p++ = '\0';
-    *lineptr = bufptr;
-    *n = size;
-
-    return p - bufptr - 1;
-}
\ No newline at end of file
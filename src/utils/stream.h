@@ -1,9 +0,0 @@
-#ifndef STREAM_H_
-#define STREAM_H_
-
-#include <stdio.h>
-#include <stdlib.h>
-
-size_t getline(char **lineptr, size_t *n, FILE *stream);
-
-#endif // STREAM_H_
\ No newline at end of file
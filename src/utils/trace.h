@@ -0,0 +1,72 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+/*
+    Static tracepoints. TRACE_PROBEn(name, ...) marks a USDT probe
+    thor:name with n arguments, each passed as 64 bits. Probes are
+    listed by "perf probe -x db --add sdt_thor:*", "bpftrace -l
+    'usdt:./db:thor:*'" or "readelf -n db". A probe nobody attached to
+    is one nop.
+
+    The probe is a nop and a .note.stapsdt ELF note that says where the
+    nop is and where its arguments live. That is the layout <sys/sdt.h>
+    emits, written out here so building needs no SystemTap headers.
+    THOR_NO_PROBES, or a target other than x86-64 or AArch64 ELF, compiles
+    the probes away.
+*/
+#if !defined(THOR_NO_PROBES) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#if defined(__x86_64__)
+#define TRACE_ARG_CONSTRAINT "nor"
+#else
+#define TRACE_ARG_CONSTRAINT "nr"
+#endif
+
+#define TRACE_NOTE(name, args)                                                \
+    "990: nop\n"                                                              \
+    ".pushsection .note.stapsdt,\"\",\"note\"\n"                              \
+    ".balign 4\n"                                                             \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                        \
+    "991: .asciz \"stapsdt\"\n"                                               \
+    "992: .balign 4\n"                                                        \
+    "993: .8byte 990b\n"                                                      \
+    ".8byte _.stapsdt.base\n"                                                 \
+    ".8byte 0\n"                                                              \
+    ".asciz \"thor\"\n"                                                       \
+    ".asciz \"" #name "\"\n"                                                  \
+    ".asciz \"" args "\"\n"                                                   \
+    "994: .balign 4\n"                                                        \
+    ".popsection\n"                                                           \
+    ".ifndef _.stapsdt.base\n"                                                \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"   \
+    ".weak _.stapsdt.base\n"                                                  \
+    ".hidden _.stapsdt.base\n"                                                \
+    "_.stapsdt.base: .space 1\n"                                              \
+    ".size _.stapsdt.base, 1\n"                                               \
+    ".popsection\n"                                                           \
+    ".endif\n"
+
+#define TRACE_ARG(n, value) [a##n] TRACE_ARG_CONSTRAINT ((uint64_t)(value))
+
+#define TRACE_PROBE0(name) \
+    __asm__ __volatile__(TRACE_NOTE(name, "") ::)
+#define TRACE_PROBE1(name, a) \
+    __asm__ __volatile__(TRACE_NOTE(name, "8@%[a1]") :: TRACE_ARG(1, a))
+#define TRACE_PROBE2(name, a, b) \
+    __asm__ __volatile__(TRACE_NOTE(name, "8@%[a1] 8@%[a2]") :: TRACE_ARG(1, a), TRACE_ARG(2, b))
+#define TRACE_PROBE3(name, a, b, c)                                             \
+    __asm__ __volatile__(TRACE_NOTE(name, "8@%[a1] 8@%[a2] 8@%[a3]")            \
+                         :: TRACE_ARG(1, a), TRACE_ARG(2, b), TRACE_ARG(3, c))
+
+#else
+
+#define TRACE_PROBE0(name) do {} while (0)
+#define TRACE_PROBE1(name, a) do { (void)(a); } while (0)
+#define TRACE_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define TRACE_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+
+#endif
+
+#endif // TRACE_H_
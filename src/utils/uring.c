@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+static int io_uring_setup(uint32_t entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/*
+    Set up a ring of entries requests. Returns NULL when the kernel
+    has no io_uring or does not let us use it, callers then fall back
+    to plain system calls.
+*/
+IoRing* io_ring_open(uint32_t entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = io_uring_setup(entries, &params);
+    if (ring_fd < 0)
+        return NULL;
+    IoRing* ring = malloc(sizeof(IoRing));
+    ring->ring_fd = ring_fd;
+    ring->entries = params.sq_entries;
+    ring->num_queued = 0;
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd, IORING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        printf("Error mapping io_uring: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    ring->sq_head = ring->sq_map + params.sq_off.head;
+    ring->sq_tail = ring->sq_map + params.sq_off.tail;
+    ring->sq_mask = ring->sq_map + params.sq_off.ring_mask;
+    ring->sq_array = ring->sq_map + params.sq_off.array;
+    ring->cq_head = ring->cq_map + params.cq_off.head;
+    ring->cq_tail = ring->cq_map + params.cq_off.tail;
+    ring->cq_mask = ring->cq_map + params.cq_off.ring_mask;
+    ring->cqes = ring->cq_map + params.cq_off.cqes;
+    return ring;
+}
+
+// false when the batch is full, submit it first
+static bool io_ring_queue(IoRing* ring, uint8_t opcode, int fd, const void* buffer,
+                          uint32_t length, off_t offset)
+{
+    if (ring->num_queued == ring->entries)
+        return false;
+    uint32_t tail = *ring->sq_tail;
+    uint32_t index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = length;
+    sqe->off = offset;
+    // the expected length comes back with the completion
+    sqe->user_data = length;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->num_queued++;
+    return true;
+}
+
+bool io_ring_read(IoRing* ring, int fd, void* buffer, uint32_t length, off_t offset)
+{
+    return io_ring_queue(ring, IORING_OP_READ, fd, buffer, length, offset);
+}
+
+bool io_ring_write(IoRing* ring, int fd, const void* buffer, uint32_t length, off_t offset)
+{
+    return io_ring_queue(ring, IORING_OP_WRITE, fd, buffer, length, offset);
+}
+
+/*
+    Hand every queued request to the kernel and wait for all of them.
+    Returns false if any failed or moved fewer bytes than asked for.
+*/
+bool io_ring_submit(IoRing* ring)
+{
+    uint32_t pending = ring->num_queued;
+    bool ok = true;
+    while (pending > 0) {
+        int result = io_uring_enter(ring->ring_fd, ring->num_queued, pending, IORING_ENTER_GETEVENTS);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("Error submitting io_uring requests: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        ring->num_queued -= result;
+        uint32_t head = *ring->cq_head;
+        uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->res < 0 || (uint64_t)cqe->res != cqe->user_data)
+                ok = false;
+            pending--;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
+
+void io_ring_close(IoRing* ring)
+{
+    munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+    munmap(ring->sq_map, ring->sq_map_size);
+    munmap(ring->cq_map, ring->cq_map_size);
+    close(ring->ring_fd);
+    free(ring);
+}
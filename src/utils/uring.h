@@ -0,0 +1,47 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// submission queue entries, the most requests one io_ring_submit carries
+#ifndef IO_RING_ENTRIES
+#define IO_RING_ENTRIES 64
+#endif
+
+/*
+    A small io_uring driven through the raw system calls. Reads and
+    writes are queued with io_ring_read / io_ring_write and go to the
+    kernel together in io_ring_submit, one system call for the batch.
+*/
+typedef struct
+{
+    int ring_fd;
+    uint32_t entries;
+    // submission ring
+    void* sq_map;
+    size_t sq_map_size;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    struct io_uring_sqe* sqes;
+    // completion ring
+    void* cq_map;
+    size_t cq_map_size;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+    // queued since the last submit
+    uint32_t num_queued;
+} IoRing;
+
+IoRing* io_ring_open(uint32_t entries);
+bool io_ring_read(IoRing* ring, int fd, void* buffer, uint32_t length, off_t offset);
+bool io_ring_write(IoRing* ring, int fd, const void* buffer, uint32_t length, off_t offset);
+bool io_ring_submit(IoRing* ring);
+void io_ring_close(IoRing* ring);
+
+#endif // URING_H_
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "wal.h"
+
+#define WAL_INDEX_EMPTY UINT32_MAX
+
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+static uint32_t crc32_update(uint32_t crc, const void* data, size_t length)
+{
+    if (!crc_table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+        crc_table_ready = true;
+    }
+    const uint8_t* bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+        crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t frame_checksum(const WalFrameHeader* header, const void* page, uint32_t page_size)
+{
+    // the checksum covers every header field before it and the page image
+    uint32_t crc = crc32_update(0, header, offsetof(WalFrameHeader, checksum));
+    return crc32_update(crc, page, page_size);
+}
+
+static uint64_t now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static off_t frame_offset(Wal* wal, uint32_t frame_num)
+{
+    return sizeof(WalHeader) + (off_t)frame_num * (sizeof(WalFrameHeader) + wal->page_size);
+}
+
+static void wal_index_reset(Wal* wal, uint32_t capacity)
+{
+    free(wal->index_pages);
+    free(wal->index_frames);
+    wal->index_capacity = capacity;
+    wal->index_size = 0;
+    wal->index_pages = malloc(capacity * sizeof(uint32_t));
+    wal->index_frames = malloc(capacity * sizeof(uint32_t));
+    for (uint32_t i = 0; i < capacity; i++)
+        wal->index_pages[i] = WAL_INDEX_EMPTY;
+}
+
+static uint32_t wal_index_slot(Wal* wal, uint32_t page_num)
+{
+    uint32_t slot = (page_num * 2654435761u) & (wal->index_capacity - 1);
+    while (wal->index_pages[slot] != WAL_INDEX_EMPTY && wal->index_pages[slot] != page_num)
+        slot = (slot + 1) & (wal->index_capacity - 1);
+    return slot;
+}
+
+static void wal_index_put(Wal* wal, uint32_t page_num, uint32_t frame_num)
+{
+    if ((wal->index_size + 1) * 10 > wal->index_capacity * 7) {
+        uint32_t* pages = wal->index_pages;
+        uint32_t* frames = wal->index_frames;
+        uint32_t capacity = wal->index_capacity;
+        wal->index_pages = wal->index_frames = NULL;
+        wal_index_reset(wal, capacity * 2);
+        for (uint32_t i = 0; i < capacity; i++) {
+            if (pages[i] != WAL_INDEX_EMPTY)
+                wal_index_put(wal, pages[i], frames[i]);
+        }
+        free(pages);
+        free(frames);
+    }
+    uint32_t slot = wal_index_slot(wal, page_num);
+    if (wal->index_pages[slot] == WAL_INDEX_EMPTY) {
+        wal->index_pages[slot] = page_num;
+        wal->index_size++;
+    }
+    wal->index_frames[slot] = frame_num;
+}
+
+static void wal_write_header(Wal* wal)
+{
+    WalHeader header;
+    header.magic = WAL_MAGIC;
+    header.page_size = wal->page_size;
+    header.salt = wal->salt;
+    header.checksum = crc32_update(0, &header, offsetof(WalHeader, checksum));
+    if (pwrite(wal->file_descriptor, &header, sizeof(header), 0) != sizeof(header)) {
+        printf("Error writing wal header: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void wal_truncate(Wal* wal, uint32_t num_frames)
+{
+    if (ftruncate(wal->file_descriptor, frame_offset(wal, num_frames)) == -1) {
+        printf("Error truncating wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    wal->num_frames = wal->num_committed = num_frames;
+}
+
+/*
+    Scan the log and index every frame up to the last commit frame.
+    The scan stops at the first frame with a stale salt or a bad
+    checksum, which is where a crash interrupted an append.
+*/
+static void wal_recover(Wal* wal)
+{
+    WalHeader header;
+    ssize_t bytes_read = pread(wal->file_descriptor, &header, sizeof(header), 0);
+    if (bytes_read != sizeof(header) || header.magic != WAL_MAGIC ||
+        header.page_size != wal->page_size ||
+        header.checksum != crc32_update(0, &header, offsetof(WalHeader, checksum))) {
+        wal->salt = (uint32_t)now_usec();
+        wal_write_header(wal);
+        wal_truncate(wal, 0);
+        return;
+    }
+    wal->salt = header.salt;
+    void* page = malloc(wal->page_size);
+    uint32_t num_committed = 0;
+    for (uint32_t frame_num = 0;; frame_num++) {
+        WalFrameHeader frame;
+        off_t offset = frame_offset(wal, frame_num);
+        if (pread(wal->file_descriptor, &frame, sizeof(frame), offset) != sizeof(frame) ||
+            pread(wal->file_descriptor, page, wal->page_size, offset + sizeof(frame)) != wal->page_size ||
+            frame.salt != wal->salt ||
+            frame.checksum != frame_checksum(&frame, page, wal->page_size)) {
+            break;
+        }
+        if (frame.db_size != 0)
+            num_committed = frame_num + 1;
+    }
+    for (uint32_t frame_num = 0; frame_num < num_committed; frame_num++) {
+        WalFrameHeader frame;
+        pread(wal->file_descriptor, &frame, sizeof(frame), frame_offset(wal, frame_num));
+        wal_index_put(wal, frame.page_num, frame_num);
+    }
+    free(page);
+    // frames of the transaction that never committed are dropped
+    wal_truncate(wal, num_committed);
+}
+
+Wal* wal_open(const char* path, uint32_t page_size, uint32_t group_commit_size)
+{
+    int fd = open(path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        printf(" Unable to open wal with name %s \n", path);
+        exit(EXIT_FAILURE);
+    }
+    Wal* wal = malloc(sizeof(Wal));
+    wal->file_descriptor = fd;
+    wal->page_size = page_size;
+    wal->num_frames = wal->num_committed = 0;
+    wal->commits = wal->synced_commits = 0;
+    wal->syncing = false;
+    pthread_mutex_init(&wal->sync_mutex, NULL);
+    pthread_cond_init(&wal->synced, NULL);
+    wal->group_commit_size = group_commit_size == 0 ? 1 : group_commit_size;
+    wal->syncs = 0;
+    wal->ring = NULL;
+    wal->index_pages = wal->index_frames = NULL;
+    wal_index_reset(wal, 64);
+    wal_recover(wal);
+    return wal;
+}
+
+/*
+    Append a page image. A non zero db_size makes this the commit
+    frame of the current transaction.
+*/
+void wal_append(Wal* wal, uint32_t page_num, const void* page, uint32_t db_size)
+{
+    WalFrameHeader frame;
+    frame.page_num = page_num;
+    frame.db_size = db_size;
+    frame.salt = wal->salt;
+    frame.checksum = frame_checksum(&frame, page, wal->page_size);
+    struct iovec iov[2];
+    iov[0].iov_base = &frame;
+    iov[0].iov_len = sizeof(frame);
+    iov[1].iov_base = (void*)page;
+    iov[1].iov_len = wal->page_size;
+    ssize_t bytes_written = pwritev(wal->file_descriptor, iov, 2, frame_offset(wal, wal->num_frames));
+    if (bytes_written != (ssize_t)(sizeof(frame) + wal->page_size)) {
+        printf("Error writing wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    wal_index_put(wal, page_num, wal->num_frames);
+    wal->num_frames++;
+    if (db_size != 0)
+        wal->num_committed = wal->num_frames;
+}
+
+bool wal_read_page(Wal* wal, uint32_t page_num, void* page)
+{
+    uint32_t slot = wal_index_slot(wal, page_num);
+    if (wal->index_pages[slot] == WAL_INDEX_EMPTY)
+        return false;
+    off_t offset = frame_offset(wal, wal->index_frames[slot]) + sizeof(WalFrameHeader);
+    if (pread(wal->file_descriptor, page, wal->page_size, offset) != wal->page_size) {
+        printf("Error reading wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+/*
+    Count a commit whose frames are all appended and return its number
+    for wal_sync_commit. A caller that does not wait for its commits
+    leaves at most group_commit_size of them unsynced.
+*/
+uint64_t wal_commit_done(Wal* wal)
+{
+    pthread_mutex_lock(&wal->sync_mutex);
+    uint64_t commit = ++wal->commits;
+    bool full = commit - wal->synced_commits >= wal->group_commit_size;
+    pthread_mutex_unlock(&wal->sync_mutex);
+    if (full)
+        wal_sync_commit(wal, commit);
+    return commit;
+}
+
+/*
+    Group commit: return once commit is on disk. The first committer
+    to get here syncs every commit appended so far with one fdatasync
+    and wakes the others. Commits appended while it syncs wait for the
+    next leader, whose sync covers all of them.
+*/
+void wal_sync_commit(Wal* wal, uint64_t commit)
+{
+    pthread_mutex_lock(&wal->sync_mutex);
+    while (wal->synced_commits < commit) {
+        if (wal->syncing) {
+            pthread_cond_wait(&wal->synced, &wal->sync_mutex);
+            continue;
+        }
+        // every commit counted so far has its frames written
+        uint64_t target = wal->commits;
+        wal->syncing = true;
+        pthread_mutex_unlock(&wal->sync_mutex);
+        if (fdatasync(wal->file_descriptor) == -1) {
+            printf("Error syncing wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_lock(&wal->sync_mutex);
+        wal->syncing = false;
+        wal->synced_commits = target;
+        wal->syncs++;
+        pthread_cond_broadcast(&wal->synced);
+    }
+    pthread_mutex_unlock(&wal->sync_mutex);
+}
+
+void wal_sync(Wal* wal)
+{
+    pthread_mutex_lock(&wal->sync_mutex);
+    uint64_t commit = wal->commits;
+    pthread_mutex_unlock(&wal->sync_mutex);
+    wal_sync_commit(wal, commit);
+}
+
+// syncs so far, safe to read while commits run
+uint64_t wal_syncs(Wal* wal)
+{
+    pthread_mutex_lock(&wal->sync_mutex);
+    uint64_t syncs = wal->syncs;
+    pthread_mutex_unlock(&wal->sync_mutex);
+    return syncs;
+}
+
+static int compare_page_frames(const void* a, const void* b)
+{
+    uint32_t left = ((const uint32_t*)a)[0];
+    uint32_t right = ((const uint32_t*)b)[0];
+    return (left > right) - (left < right);
+}
+
+// a ring reads a batch of pages in one submit and writes them in the next
+static void wal_checkpoint_ring(Wal* wal, int db_file_descriptor, uint32_t (*pairs)[2],
+                                uint32_t count, void* run)
+{
+    for (uint32_t start = 0; start < count;) {
+        uint32_t batch = count - start;
+        if (batch > WAL_CHECKPOINT_MAX_RUN)
+            batch = WAL_CHECKPOINT_MAX_RUN;
+        if (batch > wal->ring->entries)
+            batch = wal->ring->entries;
+        for (uint32_t i = 0; i < batch; i++) {
+            io_ring_read(wal->ring, wal->file_descriptor, run + (size_t)i * wal->page_size,
+                         wal->page_size, frame_offset(wal, pairs[start + i][1]) + sizeof(WalFrameHeader));
+        }
+        bool ok = io_ring_submit(wal->ring);
+        for (uint32_t i = 0; i < batch; i++) {
+            io_ring_write(wal->ring, db_file_descriptor, run + (size_t)i * wal->page_size,
+                          wal->page_size, (off_t)pairs[start + i][0] * wal->page_size);
+        }
+        if (!ok || !io_ring_submit(wal->ring)) {
+            printf("Error checkpointing wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        start += batch;
+    }
+}
+
+// runs of adjacent pages are gathered and written with one pwrite
+static void wal_checkpoint_sync(Wal* wal, int db_file_descriptor, uint32_t (*pairs)[2],
+                                uint32_t count, void* run)
+{
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        off_t offset = frame_offset(wal, pairs[i][1]) + sizeof(WalFrameHeader);
+        if (pread(wal->file_descriptor, run + (size_t)(i - start) * wal->page_size,
+                  wal->page_size, offset) != wal->page_size) {
+            printf("Error checkpointing wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        if (i + 1 < count && i + 1 - start < WAL_CHECKPOINT_MAX_RUN &&
+            pairs[i + 1][0] == pairs[i][0] + 1) {
+            continue;
+        }
+        size_t length = (size_t)(i + 1 - start) * wal->page_size;
+        if (pwrite(db_file_descriptor, run, length, (off_t)pairs[start][0] * wal->page_size) != (ssize_t)length) {
+            printf("Error checkpointing wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        start = i + 1;
+    }
+}
+
+/*
+    Copy the latest image of every logged page into the database file
+    and start a new, empty log. Must be called between transactions.
+*/
+void wal_checkpoint(Wal* wal, int db_file_descriptor)
+{
+    wal_sync(wal);
+    if (wal->num_frames == 0)
+        return;
+    // write the pages in file order so the copy is a sequential pass
+    uint32_t (*pairs)[2] = malloc(wal->index_size * sizeof(*pairs));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < wal->index_capacity; i++) {
+        if (wal->index_pages[i] != WAL_INDEX_EMPTY) {
+            pairs[count][0] = wal->index_pages[i];
+            pairs[count][1] = wal->index_frames[i];
+            count++;
+        }
+    }
+    qsort(pairs, count, sizeof(*pairs), compare_page_frames);
+    // aligned, the database file may be open with O_DIRECT
+    void* run = NULL;
+    if (posix_memalign(&run, wal->page_size, (size_t)WAL_CHECKPOINT_MAX_RUN * wal->page_size) != 0) {
+        printf("Unable to allocate checkpoint buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    if (wal->ring != NULL)
+        wal_checkpoint_ring(wal, db_file_descriptor, pairs, count, run);
+    else
+        wal_checkpoint_sync(wal, db_file_descriptor, pairs, count, run);
+    free(run);
+    free(pairs);
+    if (fsync(db_file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    // a new salt invalidates any frame left over from this log
+    wal->salt++;
+    wal_write_header(wal);
+    wal_truncate(wal, 0);
+    fdatasync(wal->file_descriptor);
+    wal_index_reset(wal, wal->index_capacity);
+}
+
+void wal_close(Wal* wal)
+{
+    wal_sync(wal);
+    close(wal->file_descriptor);
+    pthread_cond_destroy(&wal->synced);
+    pthread_mutex_destroy(&wal->sync_mutex);
+    free(wal->index_pages);
+    free(wal->index_frames);
+    free(wal);
+}
@@ -0,0 +1,79 @@
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "uring.h"
+
+#define WAL_MAGIC 0x7468574c
+// commits a caller that does not wait for them may leave unsynced
+#ifndef WAL_GROUP_COMMIT_SIZE
+#define WAL_GROUP_COMMIT_SIZE 16
+#endif
+#ifndef WAL_CHECKPOINT_MAX_RUN
+#define WAL_CHECKPOINT_MAX_RUN 64
+#endif
+#ifndef WAL_AUTO_CHECKPOINT_FRAMES
+#define WAL_AUTO_CHECKPOINT_FRAMES 1000
+#endif
+
+/*
+    On disk the log is a WalHeader followed by frames. Each frame is a
+    WalFrameHeader and one page image. A frame with a non zero db_size
+    is a commit frame: it and every frame before it are committed.
+*/
+typedef struct
+{
+    uint32_t magic;
+    uint32_t page_size;
+    uint32_t salt;
+    uint32_t checksum;
+} WalHeader;
+
+typedef struct
+{
+    uint32_t page_num;
+    uint32_t db_size;
+    uint32_t salt;
+    uint32_t checksum;
+} WalFrameHeader;
+
+typedef struct
+{
+    int file_descriptor;
+    uint32_t page_size;
+    uint32_t salt;
+    uint32_t num_frames;
+    uint32_t num_committed;
+    // group commit: commits appended so far, how many of them are
+    // known to be on disk, whether a committer is syncing them and
+    // how many syncs that took; guarded by sync_mutex
+    uint64_t commits;
+    uint64_t synced_commits;
+    bool syncing;
+    uint64_t syncs;
+    pthread_mutex_t sync_mutex;
+    pthread_cond_t synced;
+    uint32_t group_commit_size;
+    // page_num -> latest frame holding it, open addressing
+    uint32_t* index_pages;
+    uint32_t* index_frames;
+    uint32_t index_capacity;
+    uint32_t index_size;
+    // the pager's ring if it has one, a checkpoint's pages then go
+    // through it in batches
+    IoRing* ring;
+} Wal;
+
+Wal* wal_open(const char* path, uint32_t page_size, uint32_t group_commit_size);
+void wal_append(Wal* wal, uint32_t page_num, const void* page, uint32_t db_size);
+bool wal_read_page(Wal* wal, uint32_t page_num, void* page);
+uint64_t wal_commit_done(Wal* wal);
+void wal_sync_commit(Wal* wal, uint64_t commit);
+void wal_sync(Wal* wal);
+uint64_t wal_syncs(Wal* wal);
+void wal_checkpoint(Wal* wal, int db_file_descriptor);
+void wal_close(Wal* wal);
+
+#endif // WAL_H_
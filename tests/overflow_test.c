@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../src/utils/constants.h"
+
+/*
+    overflow-test: rows that spill to overflow pages. Built with a
+    COLUMN_EMAIL_SIZE larger than a leaf's local payload (make check
+    uses 6000), since with the default sizes no row spills.
+
+    First a single thread inserts, updates and deletes spilled rows and
+    checks them through table_get, a scan and a reopen, and that freed
+    chains are reused. Then one writer keeps deleting, updating and
+    inserting spilled rows while OVERFLOW_TEST_SCANNERS threads scan,
+    and every row a scan returns must be whole.
+
+    overflow-test [db path]
+*/
+
+#ifndef OVERFLOW_TEST_ROWS
+#define OVERFLOW_TEST_ROWS 200
+#endif
+#ifndef OVERFLOW_TEST_WRITES
+#define OVERFLOW_TEST_WRITES 20000
+#endif
+#ifndef OVERFLOW_TEST_SCANNERS
+#define OVERFLOW_TEST_SCANNERS 3
+#endif
+// small enough that scans and the writer keep evicting each other's pages
+#define OVERFLOW_TEST_FRAMES ((OVERFLOW_TEST_SCANNERS + 1) * PAGER_RECENT_PINS + 16)
+
+// a cell takes at most a quarter of a leaf (LEAF_NODE_MAX_CELL_SIZE in
+// btree.h), so an email this long always spills
+#define OVERFLOW_TEST_MIN_EMAIL 1024
+#if COLUMN_EMAIL_SIZE <= OVERFLOW_TEST_MIN_EMAIL
+#error "overflow-test needs rows that spill, build it with a larger COLUMN_EMAIL_SIZE"
+#endif
+
+static uint64_t rng_state = 42;
+static pthread_mutex_t rng_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t next_random(void)
+{
+    pthread_mutex_lock(&rng_mutex);
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    uint64_t value = rng_state;
+    pthread_mutex_unlock(&rng_mutex);
+    return value;
+}
+
+static void fail(const char* message, uint64_t id)
+{
+    printf("overflow-test: %s (row %" PRIu64 ")\n", message, id);
+    exit(EXIT_FAILURE);
+}
+
+/*
+    A row's email is one letter repeated, and its username names the
+    letter and the length, so any row can be checked on its own: a
+    torn read mixes two versions and breaks one of the two.
+*/
+static void make_row(Row* row, uint64_t id, char letter, uint32_t length)
+{
+    memset(row, 0, sizeof(Row));
+    row->id = id;
+    snprintf(row->username, COLUMN_USERNAME_SIZE, "%c%u", letter, length);
+    memset(row->email, letter, length);
+}
+
+static void random_row(Row* row, uint64_t id)
+{
+    uint32_t length = OVERFLOW_TEST_MIN_EMAIL +
+                      next_random() % (COLUMN_EMAIL_SIZE - OVERFLOW_TEST_MIN_EMAIL + 1);
+    make_row(row, id, 'a' + next_random() % 26, length);
+}
+
+static void check_fields(uint64_t id, FieldSlice username, FieldSlice email)
+{
+    char name[COLUMN_USERNAME_SIZE + 1];
+    memcpy(name, username.data, username.length);
+    name[username.length] = '\0';
+    if (username.length < 2 || strtoul(name + 1, NULL, 10) != email.length)
+        fail("email length does not match the username", id);
+    for (uint32_t i = 0; i < email.length; i++) {
+        if (email.data[i] != name[0])
+            fail("torn email", id);
+    }
+}
+
+static void check_row(const Row* row)
+{
+    FieldSlice username = {row->username, strnlen(row->username, COLUMN_USERNAME_SIZE)};
+    FieldSlice email = {row->email, strnlen(row->email, COLUMN_EMAIL_SIZE)};
+    check_fields(row->id, username, email);
+}
+
+static void run(Table* table, Statement* statement, ExecuteResult expected, uint64_t id)
+{
+    if (execute_statement(statement, table) != expected)
+        fail("unexpected statement result", id);
+}
+
+static void insert_row(Table* table, Row* row)
+{
+    Statement statement = {.type = STATEMENT_INSERT, .row_to_insert = *row};
+    run(table, &statement, EXECUTE_SUCCESS, row->id);
+}
+
+static void update_row(Table* table, Row* row)
+{
+    Statement statement = {.type = STATEMENT_UPDATE, .row_to_insert = *row};
+    statement.target.id = row->id;
+    statement.target.columns[0] = COLUMN_USERNAME;
+    statement.target.columns[1] = COLUMN_EMAIL;
+    statement.target.num_columns = 2;
+    run(table, &statement, EXECUTE_SUCCESS, row->id);
+}
+
+static void delete_row(Table* table, uint64_t id)
+{
+    Statement statement = {.type = STATEMENT_DELETE};
+    statement.target.id = id;
+    run(table, &statement, EXECUTE_SUCCESS, id);
+}
+
+// scan everything, check each row, and return how many there were
+static uint32_t scan_all(Table* table)
+{
+    uint32_t count = 0;
+    Cursor* cursor = scan_start(table, 0);
+    while (!cursor->end_of_table) {
+        void* payload = scan_value(cursor);
+        check_fields(scan_key(cursor), row_view_username(payload), row_view_email(payload));
+        count++;
+        scan_advance(cursor);
+    }
+    scan_close(cursor);
+    return count;
+}
+
+static void check_rows(Table* table, const Row* rows, const bool* present)
+{
+    uint32_t expected = 0;
+    for (uint64_t id = 1; id <= OVERFLOW_TEST_ROWS; id++) {
+        Row row;
+        bool found = table_get(table, id, &row);
+        if (found != present[id])
+            fail(present[id] ? "row missing" : "deleted row found", id);
+        if (!found)
+            continue;
+        expected++;
+        check_row(&row);
+        if (memcmp(&row, &rows[id], sizeof(Row)) != 0)
+            fail("row differs from the one written", id);
+    }
+    if (scan_all(table) != expected)
+        fail("scan returned the wrong number of rows", 0);
+}
+
+static Table* open_table(const char* path)
+{
+    PagerConfig config = {.mode = PAGER_MODE_BUFFERED, .num_frames = OVERFLOW_TEST_FRAMES,
+                          .use_wal = true, .group_commit_size = WAL_GROUP_COMMIT_SIZE};
+    Table* table = db_open_with_config(path, &config);
+    table->defer_sync = true;
+    return table;
+}
+
+static void test_single_thread(const char* path)
+{
+    Table* table = open_table(path);
+    static Row rows[OVERFLOW_TEST_ROWS + 1];
+    static bool present[OVERFLOW_TEST_ROWS + 1];
+    for (uint64_t id = 1; id <= OVERFLOW_TEST_ROWS; id++) {
+        random_row(&rows[id], id);
+        insert_row(table, &rows[id]);
+        present[id] = true;
+    }
+    check_rows(table, rows, present);
+
+    for (uint64_t id = 1; id <= OVERFLOW_TEST_ROWS; id += 2) {
+        random_row(&rows[id], id);
+        update_row(table, &rows[id]);
+    }
+    for (uint64_t id = 2; id <= OVERFLOW_TEST_ROWS; id += 4) {
+        delete_row(table, id);
+        present[id] = false;
+    }
+    check_rows(table, rows, present);
+
+    // the chains freed above are reused before the file grows
+    uint32_t num_pages = table->pager->num_pages;
+    for (uint64_t id = 2; id <= OVERFLOW_TEST_ROWS; id += 4) {
+        make_row(&rows[id], id, 'z', OVERFLOW_TEST_MIN_EMAIL);
+        insert_row(table, &rows[id]);
+        present[id] = true;
+    }
+    if (table->pager->num_pages != num_pages)
+        fail("freed overflow pages were not reused", 0);
+    check_rows(table, rows, present);
+
+    db_close(table);
+    table = open_table(path);
+    check_rows(table, rows, present);
+    db_close(table);
+}
+
+typedef struct
+{
+    Table* table;
+    bool* done;
+    uint32_t scans;
+} Scanner;
+
+static void* scanner_run(void* arg)
+{
+    Scanner* scanner = arg;
+    while (!__atomic_load_n(scanner->done, __ATOMIC_RELAXED)) {
+        scan_all(scanner->table);
+        scanner->scans++;
+    }
+    statement_arena_release();
+    return NULL;
+}
+
+static void test_concurrent(const char* path)
+{
+    Table* table = open_table(path);
+    bool present[OVERFLOW_TEST_ROWS + 1];
+    for (uint64_t id = 1; id <= OVERFLOW_TEST_ROWS; id++)
+        present[id] = table_get(table, id, &(Row){0});
+
+    bool done = false;
+    Scanner scanners[OVERFLOW_TEST_SCANNERS];
+    pthread_t threads[OVERFLOW_TEST_SCANNERS];
+    for (uint32_t i = 0; i < OVERFLOW_TEST_SCANNERS; i++) {
+        scanners[i] = (Scanner){.table = table, .done = &done};
+        pthread_create(&threads[i], NULL, scanner_run, &scanners[i]);
+    }
+    for (uint32_t i = 0; i < OVERFLOW_TEST_WRITES; i++) {
+        uint64_t id = 1 + next_random() % OVERFLOW_TEST_ROWS;
+        Row row;
+        random_row(&row, id);
+        if (!present[id]) {
+            insert_row(table, &row);
+            present[id] = true;
+        } else if (next_random() % 2 == 0) {
+            update_row(table, &row);
+        } else {
+            delete_row(table, id);
+            present[id] = false;
+        }
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELAXED);
+    uint32_t scans = 0;
+    for (uint32_t i = 0; i < OVERFLOW_TEST_SCANNERS; i++) {
+        pthread_join(threads[i], NULL);
+        scans += scanners[i].scans;
+    }
+    printf("overflow-test: %u writes alongside %u scans\n", OVERFLOW_TEST_WRITES, scans);
+    db_close(table);
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "overflow-test.db";
+    char wal_path[4096];
+    snprintf(wal_path, sizeof(wal_path), "%s-wal", path);
+    unlink(path);
+    unlink(wal_path);
+    test_single_thread(path);
+    test_concurrent(path);
+    unlink(path);
+    printf("overflow-test: ok\n");
+    return 0;
+}